@@ -14,6 +14,17 @@ typedef struct Font Font;
 typedef struct Window Window;
 typedef struct Context Context;
 typedef struct Widget Widget;
+typedef struct TextBatch TextBatch;
+typedef struct StreamBuffer StreamBuffer;
+typedef struct InstanceBatch InstanceBatch;
+typedef struct LineBatch LineBatch;
+typedef struct Shader Shader;
+typedef struct HashMap HashMap;
+typedef struct TextLayout TextLayout;
+typedef struct RenderTarget RenderTarget;
+typedef struct SkinAtlas SkinAtlas;
+typedef struct Exporter Exporter;
+typedef struct HitGrid HitGrid;
 
 enum SIGNAL {
 	ACTIVATE,
@@ -22,6 +33,8 @@ enum SIGNAL {
 	HOVER,
 	RESIZE,
 	REDRAW,
+	SCROLL,
+	KEY,
 	USER_SIGNAL1,
 	USER_SIGNAL2,
 	USER_SIGNAL3
@@ -48,10 +61,24 @@ enum ALIGNMENT {
 	ALIGN_BOTTOM_RIGHT
 };
 
+enum RENDER_MODE {
+	RENDER_CONTINUOUS, // redraw every window on every loop iteration
+	RENDER_ON_DEMAND   // sleep until a window, context or widget is invalidated
+};
+
+enum LINE_MODE {
+	LINE_GEOMETRY, // triangulated segments with round cap fans
+	LINE_SDF       // one quad per segment, antialiased capsule evaluated per fragment
+};
+
 typedef struct Ck {
 	FT_Library ft;
+	HashMap *fonts;
 	Window **windows;
 	int window_count;
+	enum RENDER_MODE render_mode;
+	double wait_timeout; // upper bound on sleeps in RENDER_ON_DEMAND, <= 0 waits indefinitely
+	Exporter *exporter; // started by the first canvas export
 } Ck;
 
 typedef struct Size {
@@ -67,13 +94,20 @@ typedef struct Position {
 typedef struct Widget {
 	Position position;
 	Size size;
-	Font *font; //Optimise this later, maybe use a font manager
-	char *text;
+	Font *font; // shared through the Ck font cache, do not free directly
+	char *text; // set_widget_text replaces it and repaints, direct edits need invalidate_widget
+	TextLayout *layout;
 	enum ALIGNMENT text_alignment;
 	float text_color[3];
 	int texture_index;
 	void *data;
 	int state; // 0: normal, 1: hovered, 2: clicked
+	bool dirty;
+	Context *context;
+	bool retained; // rendered once into cache and composited until invalidated
+	RenderTarget *cache;
+	GLuint clip_mask; // optional stencil mask texture, widgets clip to their rectangle otherwise
+	int grid_cells[4]; // first and last cell the widget is indexed in by its context
 	int (*render_func)(struct Widget *widget, Window *win);
 } Widget;
 
@@ -81,27 +115,104 @@ typedef struct Context {
 	Widget **widgets;
 	int widget_count;
 	GLclampf clear_color[4];
+	bool dirty;
+	bool batch_backgrounds; // draw all widget backgrounds up front with instanced draws
+	HitGrid *hit_grid; // widgets by the cells they cover, for finding the ones under the cursor
 } Context;
 
+#define CLIP_STACK_DEPTH 32
+
+typedef struct ClipRect {
+	int x;
+	int y;
+	int width;
+	int height;
+} ClipRect;
+
+typedef struct RenderStats {
+	int drawCalls;
+	int glyphCount;
+	int drawCallsSaved; // draws avoided by batching compared to one draw per glyph
+} RenderStats;
+
+//pixels are RGBA, top row first, and only valid during the call. On failure
+//result is -1 and pixels is NULL. Always called from loopCK on the main thread.
+typedef void (*ExportCallback)(const unsigned char *pixels, int width, int height, int result, void *data);
+
+typedef struct Stroke {
+	const Position *points;
+	int count;
+	float thickness;
+	GLfloat color[3];
+	bool erase;
+} Stroke;
+
+enum INPUT_EVENT {
+	INPUT_CURSOR,
+	INPUT_CURSOR_LEAVE,
+	INPUT_BUTTON,
+	INPUT_SCROLL,
+	INPUT_KEY
+};
+
+typedef struct InputEvent {
+	enum INPUT_EVENT type;
+	double time; // glfwGetTime() when GLFW reported the event
+	Position position; // cursor position at the time, relative to the bottom left corner
+	int button; // GLFW_MOUSE_BUTTON_*, for INPUT_BUTTON
+	int key; // GLFW_KEY_*, for INPUT_KEY
+	int scancode;
+	int action; // GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT
+	int mods;
+	double scroll[2]; // x and y offsets, for INPUT_SCROLL
+} InputEvent;
+
 typedef struct Window {
 	GLFWwindow *window;
 	int width;
 	int height;
 	char *title;
 	Context *context;
-	GLuint shaderPrograms[3];
-	GLuint *textures;
+	Context *rendered_context; // context drawn by the last frame
+	bool dirty;
+	GLuint framebuffer; // target the widgets are currently drawn into, 0 for the window
+	bool offscreen; // drawing into a widget cache, colour is written premultiplied
+	ClipRect clip_stack[CLIP_STACK_DEPTH];
+	int clip_depth;
+	int clip_overflow; // pushes beyond CLIP_STACK_DEPTH, their pops only count down
+	int clip_origin[2]; // offset from window coordinates to the bound framebuffer
+	Shader *shaderPrograms[5]; // text, texture, line, instanced texture and stroke (optional)
+	GLuint frameUniforms;
+	Size frameSize;
+	SkinAtlas *skins; // widget skins, shared by every window of the Ck instance
+	StreamBuffer *quadStream;
+	StreamBuffer *lineStream;
+	StreamBuffer *strokeStream;
+	TextBatch *textBatch;
+	LineBatch *lineBatch;
+	InstanceBatch *backgroundBatch;
+	bool backgrounds_batched; // backgrounds of the current context were already drawn
+	InputEvent *events; // queued by the GLFW callbacks, drained once per loop iteration
+	int eventCount;
+	int eventCapacity;
+	Position cursor; // cursor and held buttons as of the last dispatched event
+	int buttons;
+	bool cursorInside;
+	Context *hitContext; // context and grid version the widget states were computed for
+	unsigned int hitVersion;
+	RenderStats stats;
 } Window;
 
-typedef struct Bucket {
+typedef struct HashMapEntry {
 	long long int key;
 	void *value;
-	struct Bucket *next;
-} Bucket;
+	bool used;
+} HashMapEntry;
 
 typedef struct HashMap {
-	Bucket **buckets;
+	HashMapEntry *entries;
 	size_t size, count;
+	size_t minSize;
 } HashMap;
 
 //CK functions
@@ -109,6 +220,7 @@ typedef struct HashMap {
 Ck *initCK();
 void destroyCK(Ck *ck);
 int loopCK(Ck *ck);
+void set_render_mode(Ck *ck, enum RENDER_MODE mode, double wait_timeout);
 
 //Window functions
 
@@ -116,27 +228,79 @@ Window *create_window(Ck *ck, int width, int height, const char *title);
 void destroy_window(Window *win);
 void set_window_title(Window *win, const char *title);
 int set_window_size(Window *win, int width, int height);
+//Returns the counters of the most recently rendered frame
+RenderStats window_render_stats(Window *win);
+//The invalidate functions are main thread only, like the rest of Ck. Other
+//threads hand work to the main thread and wake it with glfwPostEmptyEvent.
+void invalidate_window(Window *win);
 
 //Context functions
 
 Context *create_context();
 void destroy_context(Context *ctx);
 int add_widget(Context *ctx, Widget *widget);
+void invalidate_context(Context *ctx);
+//Draws the backgrounds of all built-in widgets first, one instanced draw per texture.
+//Backgrounds no longer interleave with the text and lines of earlier widgets,
+//so only enable it when widgets of the context do not overlap.
+void set_context_batching(Context *ctx, bool enabled);
 
 //Widget functions
 
 Widget *create_push_button(Ck *ck, Position position, Size size, const char *font_name, const char *text, enum ALIGNMENT text_alignment, float text_color[3]);
 Widget *create_canvas(Ck *ck, Position position, Size size, const char *font_name, const char *text, enum ALIGNMENT text_alignment, float text_color[3]);
+//Canvas whose surface is split into tiles that are allocated where strokes land,
+//for drawing surfaces too large to keep in one texture.
+Widget *create_tiled_canvas(Ck *ck, Position position, Size size, const char *font_name, const char *text, enum ALIGNMENT text_alignment, float text_color[3]);
 Widget *create_textbox(Ck *ck, Position position, Size size, const char *font_name, const char *text, float text_color[3], bool autoresize);
 int destroy_widget(Widget *widget);
+//Selects how the canvas rasterizes its lines, LINE_SDF falls back to LINE_GEOMETRY
+//when the stroke shader is not available.
+int set_canvas_line_mode(Widget *canvas, enum LINE_MODE mode);
+//Simplifies queued strokes before they are rasterized: points closer than min_segment
+//pixels to their predecessor are dropped, straight runs are merged, and a tolerance
+//above 0 also applies Ramer-Douglas-Peucker with that many pixels. Pass 0, 0 to disable.
+int set_canvas_simplification(Widget *canvas, float min_segment, float tolerance);
+//Pans and zooms the canvas: the canvas point (x, y) is shown at the widget's origin and
+//one canvas pixel covers zoom window pixels. Zoomed out tiled canvases read downsampled tiles.
+int set_canvas_view(Widget *canvas, float x, float y, float zoom);
+//Converts a window position, e.g. from mouse_position, to canvas coordinates.
+Position canvas_point(Widget *canvas, Position point);
+//Keeps undo history for the canvas: the pixels under every flushed batch of strokes are
+//saved run length encoded, oldest first out once they exceed budget bytes. 0 disables it.
+int set_canvas_history(Widget *canvas, size_t budget);
+//Queued like strokes, so they apply after the lines drawn before the call.
+int undo_canvas(Widget *canvas);
+int redo_canvas(Widget *canvas);
 int draw_line_to_canvas(Position start, Position end, bool erase, GLfloat color[3], float thickness, Widget *canvas);
+//Copies the points and draws them as one stroke with round joins, a single point draws a dot.
+int draw_polyline_to_canvas(const Position *points, int count, bool erase, GLfloat color[3], float thickness, Widget *canvas);
+int draw_strokes_to_canvas(const Stroke *strokes, int count, Widget *canvas);
+//Snapshots the canvas, including lines drawn before the call, without stalling the
+//render loop: the pixels are read back asynchronously and encoded on a worker thread.
+int export_canvas_png(Widget *canvas, const char *path, ExportCallback callback, void *data);
+int export_canvas_pixels(Widget *canvas, ExportCallback callback, void *data);
+//Packs the image into the shared skin atlas, widgets whose skins share a page batch together.
 int set_widget_texture(Ck *ck, Widget *widget, const char *texture_path);
+int set_widget_text(Widget *widget, const char *text);
+//Moves or resizes the widget, use these rather than writing the fields so the
+//context keeps finding the widget under the cursor.
+int set_widget_position(Widget *widget, Position position);
+int set_widget_size(Widget *widget, Size size);
+//Marks the widget for repainting, needed in RENDER_ON_DEMAND after changing its fields directly
+void invalidate_widget(Widget *widget);
+//Caches the widget's rendering in an offscreen texture that is reused until the widget is invalidated
+int set_widget_retained(Widget *widget, bool retained);
 
 //utility functions
 
 //Returns the mouse position relative to the bottom left corner of the window
 Position mouse_position(Window* window);
 void mouse_state(Window *win, int *left, int *right, int *middle);
+//Returns the input event being dispatched while a CLICK, HOVER, SCROLL or KEY
+//handler runs, NULL anywhere else. KEY goes to the hovered widgets, or the window
+//when there are none, like CLICK and SCROLL.
+const InputEvent *input_event();
 Window* ck_active_window(Ck* ck);
 Window* ck_window_under_cursor(Ck* ck);
 
@@ -154,6 +318,16 @@ void *hashmap_get(HashMap *map, long long int key);
 void *hashmap_replace(HashMap *map, long long int key, void* value);
 HashMap *hashmap_resize(HashMap *map, int size);
 int hashmap_remove(HashMap *map, long long int key);
+//Iterates over the entries in table order, start with *iterator = 0.
+//Entries must not be inserted or removed while iterating.
+bool hashmap_next(HashMap *map, size_t *iterator, long long int *key, void **value);
+
+//Font functions
+
+//Rasterizes the glyphs of [first, last] ahead of time, e.g. 0x20-0x7E for Basic Latin.
+//Glyphs are otherwise rasterized the first time they are drawn or measured.
+//Returns the number of glyphs the font provides in the range, or -1 on error.
+int preload_font_glyphs(Font *font, uint32_t first, uint32_t last);
 
 // UTF-8 support functions
 int utf8_decode(const char *str, uint32_t *codepoint);
@@ -3,8 +3,29 @@
 
 #include "ck.h"
 
+#define FONT_ATLAS_SIZE 1024
+#define GLYPH_PAGE_BITS 8
+#define GLYPH_PAGE_SIZE (1 << GLYPH_PAGE_BITS)
+#define GLYPH_PAGE_COUNT 256
+#define GLYPH_TABLE_LIMIT (GLYPH_PAGE_SIZE * GLYPH_PAGE_COUNT) // the table covers the BMP
+#define FONT_ATLAS_PADDING 1
+#define SKIN_ATLAS_SIZE 2048
+#define SKIN_ATLAS_PADDING 1 // border of repeated edge texels around every skin
+#define HIT_GRID_CELL_SIZE 128.0f
+#define HIT_GRID_MAX_CELLS 64 // widgets covering more cells are always tested instead
+
+typedef struct AtlasPacker {
+	int width;
+	int height;
+	int padding;
+	int penX;
+	int penY;
+	int rowHeight;
+} AtlasPacker;
+
 typedef struct Glyph {
-	GLuint textureID;
+	int page;
+	float uv[4]; // u0, v0, u1, v1 inside the atlas page
 	int width;
 	int height;
 	int bearingX;
@@ -13,25 +34,78 @@ typedef struct Glyph {
 } Glyph;
 
 typedef struct Font {
-	HashMap* glyphs;
+	char *path;
+	int refCount;
+	HashMap *cache; // Ck::fonts, keyed by font_key(path, fontSize)
+	struct Font *next; // next font whose key collides in the cache
+	FT_Face face;
+	Glyph **glyphTable[GLYPH_PAGE_COUNT]; // two-level table over the BMP, pages allocated on first use
+	HashMap* glyphs; // codepoints beyond the BMP
+	GLuint *pages;
+	int pageCount;
+	unsigned int generation; // bumped when the pages are released, older layouts are stale
+	AtlasPacker packer;
 	int fontSize;
 	int lineHeight;
 	int ascender;
 	int descender;
 } Font;
 
-typedef struct textRenderParameters {
-	GLuint shaderProgram;
-	Font* font;
-	const char* text;
-	float x;
-	float y;
-	float scale;
-	float color[3];
-} textRenderParameters;
+#define FRAME_UNIFORM_BINDING 0
+
+enum SHADER_UNIFORM {
+	UNIFORM_SCREEN_SIZE,
+	UNIFORM_TEXT_COLOR,
+	UNIFORM_TINT_COLOR,
+	UNIFORM_INTENSITY,
+	UNIFORM_LINE_COLOR,
+	UNIFORM_ERASE,
+	UNIFORM_COUNT
+};
+
+typedef struct Shader {
+	GLuint program;
+	GLint uniforms[UNIFORM_COUNT];
+	GLuint frameBlock;
+	float screenSize[2]; // last value written to the screenSize uniform
+} Shader;
+
+typedef struct Skin {
+	GLuint texture; // atlas page, or a texture of its own when standalone
+	float uv[4]; // u0, v0, u1, v1, v0 is the bottom row
+	bool standalone;
+} Skin;
+
+typedef struct SkinAtlas {
+	GLuint *pages;
+	int pageCount;
+	AtlasPacker packer;
+	Skin *skins; // indexed by Widget::texture_index
+	int skinCount;
+	int skinCapacity;
+} SkinAtlas;
+
+typedef struct HitCell {
+	Widget **widgets;
+	int count;
+	int capacity;
+} HitCell;
+
+typedef struct HitGrid {
+	HashMap *cells; // HitCell by tile_key(0, x, y) of HIT_GRID_CELL_SIZE cells
+	Widget **large; // widgets over HIT_GRID_MAX_CELLS cells, candidates everywhere
+	int largeCount;
+	int largeCapacity;
+	Widget **active; // widgets with a non-zero state, reset once the cursor leaves them
+	int activeCount;
+	int activeCapacity;
+	Widget **candidates; // returned by hit_grid_query
+	int candidateCapacity;
+	unsigned int version; // bumped whenever a widget is indexed, moved or removed
+} HitGrid;
 
 typedef struct textureRenderParameters {
-	GLuint shaderProgram;
+	Shader *shader;
 	float x;
 	float y;
 	int width;
@@ -39,8 +113,127 @@ typedef struct textureRenderParameters {
 	float color[3];
 	float intensity;
 	GLuint textureID;
+	const float *uv; // sub-rectangle as in Skin::uv, the whole texture when NULL
+	bool premultiplied;
 } textureRenderParameters;
 
+typedef struct RenderTarget {
+	GLuint FBO;
+	GLuint texture;
+	GLuint stencil;
+	int width;
+	int height;
+	bool valid;
+} RenderTarget;
+
+typedef struct StreamBuffer {
+	GLuint VAO;
+	GLuint VBO;
+	GLsizeiptr capacity;
+	GLsizeiptr offset;
+	GLsizei stride;
+} StreamBuffer;
+
+typedef struct TextRun {
+	GLuint texture;
+	float color[3];
+	int first;
+	int count;
+} TextRun;
+
+typedef struct TextBatch {
+	Shader *shader;
+	GLfloat (*vertices)[4];
+	int vertexCount;
+	int vertexCapacity;
+	TextRun *runs;
+	int runCount;
+	int runCapacity;
+	int glyphCount;
+} TextBatch;
+
+#define LINE_CAP_SEGMENTS 16
+#define LINE_VERTEX_COUNT (6 + 2 * LINE_CAP_SEGMENTS * 3)
+
+typedef struct LineRun {
+	GLfloat color[3];
+	bool erase;
+	int first;
+	int count;
+} LineRun;
+
+typedef struct StrokeVertex {
+	GLfloat position[2];
+	GLfloat segment[4]; // start and end of the segment the quad covers
+	GLfloat radius;
+} StrokeVertex;
+
+typedef struct LineBatch {
+	bool sdf; // capsule quads for the stroke shader instead of tessellated caps
+	Position *vertices;
+	StrokeVertex *strokeVertices;
+	int vertexCount;
+	int vertexCapacity;
+	int strokeCapacity;
+	LineRun *runs;
+	int runCount;
+	int runCapacity;
+	int lineCount;
+	Position origin; // subtracted from every point, places canvas strokes in a tile
+	Position lastEnd; // end of the previous line, its cap is shared with a continuing line
+	float lastThickness;
+} LineBatch;
+
+typedef struct QuadInstance {
+	GLfloat rect[4]; // x, y, width, height in window pixels
+	GLfloat tint[4]; // rgb tint, intensity in w
+	GLfloat uv[4];
+	GLuint texture; // not uploaded, selects the group
+} QuadInstance;
+
+typedef struct InstanceGroup {
+	GLuint texture;
+	int first;
+	int count;
+} InstanceGroup;
+
+typedef struct InstanceBatch {
+	GLuint VAO;
+	GLuint quadVBO;
+	GLuint instanceVBO;
+	GLsizeiptr instanceCapacity;
+	QuadInstance *instances;
+	QuadInstance *sorted;
+	int count;
+	int capacity;
+	InstanceGroup *groups;
+	int groupCount;
+	int groupCapacity;
+} InstanceBatch;
+
+typedef struct LayoutGlyph {
+	float x; // relative to the widget origin
+	float y;
+	float width;
+	float height;
+	float uv[4];
+	GLuint texture;
+} LayoutGlyph;
+
+typedef struct TextLayout {
+	const char *text; // the widget text the layout was built from
+	size_t textLength; // with textHash, catches text edited in place or reallocated at the same address
+	unsigned long long textHash;
+	Font *font;
+	unsigned int fontGeneration; // the glyph textures belong to this generation of the font
+	Size size;
+	enum ALIGNMENT alignment;
+	bool valid;
+	LayoutGlyph *glyphs;
+	int count;
+	int capacity;
+} TextLayout;
+
 typedef struct Line {
 	Position start;
 	Position end;
@@ -49,15 +242,119 @@ typedef struct Line {
 	bool erase;
 } Line;
 
-typedef struct drawQueue {
-	Line val;
-	struct drawQueue *next;
-} drawQueue;
+enum CANVAS_COMMAND {
+	CANVAS_LINE,
+	CANVAS_POLYLINE,
+	CANVAS_UNDO,
+	CANVAS_REDO
+};
+
+typedef struct Polyline {
+	int first; // into CommandBuffer::points
+	int count;
+	float thickness;
+	GLfloat color[3];
+	bool erase;
+} Polyline;
+
+typedef struct CanvasCommand {
+	enum CANVAS_COMMAND type;
+	union {
+		Line line;
+		Polyline polyline;
+	};
+} CanvasCommand;
+
+// Commands recorded between two renders of a canvas, in submission order.
+typedef struct CommandBuffer {
+	CanvasCommand *commands;
+	int count;
+	int capacity;
+	Position *points; // vertices of every polyline command
+	int pointCount;
+	int pointCapacity;
+	unsigned char *keep; // simplification scratch
+	int *stack;
+	int scratchCapacity;
+} CommandBuffer;
+
+typedef struct ExportJob {
+	char *path; // NULL for raw pixels
+	ExportCallback callback;
+	void *data;
+	int width;
+	int height;
+	GLuint PBO;
+	GLsync fence;
+	unsigned char *pixels;
+	int result;
+	struct ExportJob *next;
+} ExportJob;
+
+typedef struct Exporter {
+	ExportJob *readHead, *readTail; // readbacks in flight, main thread only
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool quit;
+	ExportJob *encodeHead, *encodeTail; // guarded by lock
+	ExportJob *doneHead, *doneTail; // guarded by lock
+} Exporter;
+
+#define CANVAS_TILE_SIZE 256
+#define CANVAS_PYRAMID_LEVELS 8 // level n tiles cover 2^n x 2^n level 0 tiles
+
+typedef struct CanvasTile {
+	int level;
+	int x; // in tiles of its level
+	int y;
+	GLuint texture;
+	GLuint FBO;
+	bool touched; // receives strokes in the current flush
+} CanvasTile;
+
+typedef struct HistoryPatch {
+	int tileX; // level 0 tile of a tiled canvas, -1 otherwise
+	int tileY;
+	int x; // region in the texture
+	int y;
+	int width;
+	int height;
+	unsigned char *data; // run length encoded RGBA
+	size_t size;
+} HistoryPatch;
+
+typedef struct HistoryStep {
+	HistoryPatch *patches;
+	int count;
+	size_t bytes;
+} HistoryStep;
+
+typedef struct CanvasHistory {
+	HistoryStep *steps; // [0, current) can be undone, [current, count) redone
+	int count;
+	int capacity;
+	int current;
+	size_t bytes;
+	size_t budget; // 0 disables the history
+} CanvasHistory;
 
 typedef struct canvasData {
-	GLuint bitmap;
+	GLuint bitmap; // 0 for tiled canvases
 	GLuint FBO;
-	drawQueue *lineQueue;
+	CommandBuffer commands;
+	enum LINE_MODE lineMode;
+	float minSegment; // simplification is off while both are 0
+	float tolerance;
+	ExportJob *exports; // waiting for the next render of the canvas
+	HashMap *tiles; // CanvasTile by tile_key, NULL unless tiled
+	CanvasTile **touched; // tiles to redraw, level 0 first, then their ancestors level by level
+	int touchedCount;
+	int touchedCapacity;
+	float viewX; // canvas point shown at the widget's origin
+	float viewY;
+	float zoom;
+	CanvasHistory history;
 } canvasData;
 
 typedef struct textboxData {
@@ -68,18 +365,95 @@ typedef struct textboxData {
 
 char *read_file(const char* filename);
 GLuint load_texture(const char* filename);
-GLuint load_shader(const char* vertexPath, const char* fragmentPath);
+Shader *load_shader(const char* vertexPath, const char* fragmentPath);
+void destroy_shader(Shader *shader);
+void use_shader(Shader *shader, Window *win);
+void set_frame_size(Window *win, int width, int height);
 GLuint generate_texture(int width, int height, const unsigned char* data);
-void mouse_state_check(Window *win);
+void dispatch_input_events(Window *win);
 int get_alignment_offset_x(enum ALIGNMENT alignment, Size size, const char *text, Font *font);
+int alignment_offset_x(enum ALIGNMENT alignment, Size size, int text_width);
 int get_alignment_offset_y(enum ALIGNMENT alignment,Size size, int ascender, int total_lines, int line_index);
-int text_width(const char* text, HashMap* glyphs);
-int line_count(const char *str, int width, HashMap *glyphs);
+int text_width(const char* text, Font* font);
+int line_count(const char *str, int width, Font *font);
+
+//Atlas functions
+
+void atlas_packer_init(AtlasPacker *packer, int width, int height, int padding);
+int atlas_packer_insert(AtlasPacker *packer, int width, int height, int *x, int *y);
 
 //Font functions
 
 Font* get_font(const char* fontPath, int fontSize, FT_Library *ft);
 void free_font(Font *font);
+Glyph *font_load_glyph(Font *font, uint32_t codepoint);
+
+extern Glyph font_missing_glyph;
+
+static inline Glyph *font_get_glyph(Font *font, uint32_t codepoint) {
+	if (codepoint < GLYPH_TABLE_LIMIT) {
+		Glyph **page = font->glyphTable[codepoint >> GLYPH_PAGE_BITS];
+		Glyph *glyph = page ? page[codepoint & (GLYPH_PAGE_SIZE - 1)] : NULL;
+		if (glyph)
+			return glyph == &font_missing_glyph ? NULL : glyph;
+	}
+	return font_load_glyph(font, codepoint);
+}
+Font *acquire_font(Ck *ck, const char *fontPath, int fontSize);
+void release_font(Font *font);
+void release_font_pages(HashMap *cache);
+void destroy_font_cache(HashMap *cache);
+
+// Layout functions
+
+TextLayout *widget_text_layout(Widget *widget);
+void invalidate_text_layout(Widget *widget);
+void destroy_text_layout(TextLayout *layout);
+
+// Batch functions
+
+StreamBuffer *stream_buffer_create(GLsizeiptr capacity, GLint components);
+StreamBuffer *stream_buffer_create_attributes(GLsizeiptr capacity, const GLint *components, int attributeCount);
+void stream_buffer_destroy(StreamBuffer *stream);
+GLint stream_buffer_upload(StreamBuffer *stream, const void *data, GLsizeiptr size);
+TextBatch *text_batch_create();
+void text_batch_destroy(TextBatch *batch);
+void text_batch_add_layout(TextBatch *batch, Shader *shader, const TextLayout *layout, float x, float y, const float color[3]);
+void text_batch_flush(TextBatch *batch, Window *win);
+LineBatch *line_batch_create();
+void line_batch_destroy(LineBatch *batch);
+void line_batch_begin(LineBatch *batch, bool sdf, Position origin);
+void line_batch_add(LineBatch *batch, const Line *line);
+void line_batch_add_polyline(LineBatch *batch, const Position *points, const Polyline *polyline);
+void line_batch_flush(LineBatch *batch, Shader *shader, Window *win);
+InstanceBatch *instance_batch_create();
+void instance_batch_destroy(InstanceBatch *batch);
+void instance_batch_add(InstanceBatch *batch, const Skin *skin, float x, float y, float width, float height, const float tint[3], float intensity);
+void instance_batch_flush(InstanceBatch *batch, Shader *shader, Window *win);
+
+// Skin functions
+
+SkinAtlas *skin_atlas_create();
+void skin_atlas_destroy(SkinAtlas *atlas);
+int skin_atlas_load(SkinAtlas *atlas, const char *path);
+const Skin *skin_atlas_get(SkinAtlas *atlas, int index);
+
+// Hit grid functions
+
+HitGrid *hit_grid_create();
+void hit_grid_destroy(HitGrid *grid);
+int hit_grid_insert(HitGrid *grid, Widget *widget);
+void hit_grid_remove(HitGrid *grid, Widget *widget);
+int hit_grid_update(HitGrid *grid, Widget *widget);
+Widget **hit_grid_query(HitGrid *grid, Position position, int *count);
+int hit_grid_activate(HitGrid *grid, Widget *widget);
+Widget **hit_grid_hovered(HitGrid *grid, int *count);
+bool hit_grid_is_active(const HitGrid *grid, const Widget *widget);
+
+// Render target functions
+
+RenderTarget *create_render_target(int width, int height);
+void destroy_render_target(RenderTarget *target);
 
 // Render functions
 
@@ -87,6 +461,10 @@ int render_widget(Widget *widget, Window *win);
 int render_canvas(Widget *widget, Window *win);
 int render_textbox(Widget *widget, Window *win);
 int render_window(Window *win);
+void push_clip_rect(Window *win, float x, float y, float width, float height);
+void pop_clip_rect(Window *win);
+void apply_clip_rect(Window *win);
+bool window_needs_redraw(Window *win);
 
 // Widget functions
 
@@ -94,9 +472,47 @@ int render_window(Window *win);
 
 void window_thread(void *win_ptr);
 
-void enqueue_line(Position start, Position end, bool erase, GLfloat color[3], float thickness, drawQueue **queue);
-void dequeue_line(drawQueue **queue);
-int queue_length(drawQueue **queue);
+CanvasCommand *command_buffer_push(CommandBuffer *buffer, enum CANVAS_COMMAND type);
+Position *command_buffer_push_points(CommandBuffer *buffer, const Position *points, int count);
+void command_buffer_reset(CommandBuffer *buffer);
+void command_buffer_free(CommandBuffer *buffer);
+void command_buffer_simplify(CommandBuffer *buffer, float minSegment, float tolerance);
+
+// 8 bits of level, 28 bits per coordinate.
+static inline long long tile_key(int level, int x, int y) {
+	return ((long long)level << 56) | ((long long)(y & 0xFFFFFFF) << 28) | (x & 0xFFFFFFF);
+}
+
+bool canvas_command_bounds(const CommandBuffer *buffer, const CanvasCommand *command, float bounds[4]);
+void add_canvas_commands(LineBatch *batch, const CommandBuffer *buffer, const float clip[4]);
+int touch_tile(canvasData *canvas, CanvasTile *tile);
+void rasterize_canvas_tiles(Window *win, canvasData *canvas, const CommandBuffer *buffer, Size size, bool sdf);
+void queue_canvas_ancestors(canvasData *canvas);
+void destroy_canvas_tiles(canvasData *canvas);
+
+// History functions
+
+void record_canvas_tiles(canvasData *canvas);
+void record_canvas_rect(canvasData *canvas, const CommandBuffer *buffer, Size size);
+int swap_canvas_history(canvasData *canvas, bool undo);
+void destroy_canvas_history(CanvasHistory *history);
+void set_canvas_history_budget(CanvasHistory *history, size_t budget);
+
+// Export functions
+
+void issue_canvas_exports(Ck *ck, canvasData *canvas, int width, int height);
+void cancel_canvas_exports(canvasData *canvas);
+void poll_exports(Ck *ck);
+bool exports_reading(Ck *ck);
+void destroy_exporter(Exporter *exporter);
+
+static inline void set_alpha_blend(Window *win) {
+	glEnable(GL_BLEND);
+	if (win->offscreen)
+		glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	else
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
 
 //callback functions
 
@@ -104,6 +520,12 @@ void error_callback(int error, const char* description);
 void debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void window_close_callback(GLFWwindow* window);
+void window_refresh_callback(GLFWwindow* window);
+void cursor_position_callback(GLFWwindow *window, double x, double y);
+void cursor_enter_callback(GLFWwindow *window, int entered);
+void mousebutton_callback(GLFWwindow *window, int button, int action, int mods);
+void scroll_callback(GLFWwindow *window, double x, double y);
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 
 //signal functions
 void signal_emit(void *sender, enum SIGNAL signal);
@@ -0,0 +1,12 @@
+#version 330 core
+in vec2 TexCoords;
+in vec4 Tint;
+
+out vec4 FragColor;
+
+uniform sampler2D image;
+
+void main() {
+	vec4 color = texture(image, TexCoords);
+	FragColor = vec4(mix(color.rgb, Tint.rgb, Tint.a), color.a);
+}
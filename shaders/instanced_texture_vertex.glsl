@@ -0,0 +1,20 @@
+#version 330 core
+layout (location = 0) in vec2 corner;   // unit quad corner, (0, 0) is bottom left
+layout (location = 1) in vec4 rect;     // x, y, width, height in window pixels
+layout (location = 2) in vec4 tint;     // tint colour, intensity in w
+layout (location = 3) in vec4 uvRect;   // skin rectangle in its atlas page, u0 v0 u1 v1
+
+layout (std140) uniform FrameData {
+	vec2 screenSize;
+};
+
+out vec2 TexCoords;
+out vec4 Tint;
+
+void main() {
+	vec2 position = rect.xy + corner * rect.zw;
+	gl_Position = vec4(position / screenSize * 2.0 - 1.0, 0.0, 1.0);
+	// Textures are stored bottom row first (see load_texture), so t follows the corner.
+	TexCoords = mix(uvRect.xy, uvRect.zw, corner);
+	Tint = tint;
+}
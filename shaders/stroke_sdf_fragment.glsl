@@ -0,0 +1,24 @@
+#version 330 core
+in vec2 Position;
+flat in vec4 Segment;
+flat in float Radius;
+
+out vec4 FragColor;
+
+uniform vec3 lineColor;
+uniform bool erase;
+
+void main() {
+	// Distance to the capsule around the segment, negative inside.
+	vec2 pa = Position - Segment.xy;
+	vec2 ba = Segment.zw - Segment.xy;
+	float h = clamp(dot(pa, ba) / max(dot(ba, ba), 1e-6), 0.0, 1.0);
+	float distance = length(pa - ba * h) - Radius;
+
+	float coverage = clamp(0.5 - distance, 0.0, 1.0);
+	if (coverage <= 0.0)
+		discard;
+
+	// Erasing scales the destination by 1 - coverage, see line_batch_flush.
+	FragColor = erase ? vec4(0.0, 0.0, 0.0, coverage) : vec4(lineColor, coverage);
+}
@@ -0,0 +1,19 @@
+#version 330 core
+layout (location = 0) in vec2 position; // quad corner in canvas pixels
+layout (location = 1) in vec4 segment;  // start and end of the stroke segment
+layout (location = 2) in float radius;  // half the stroke thickness
+
+layout (std140) uniform FrameData {
+	vec2 screenSize;
+};
+
+out vec2 Position;
+flat out vec4 Segment;
+flat out float Radius;
+
+void main() {
+	gl_Position = vec4(position / screenSize * 2.0 - 1.0, 0.0, 1.0);
+	Position = position;
+	Segment = segment;
+	Radius = radius;
+}
@@ -0,0 +1,31 @@
+#include "../libs/ck.h"
+#include "../libs/ck_internal.h"
+
+void atlas_packer_init(AtlasPacker *packer, int width, int height, int padding) {
+	packer->width = width;
+	packer->height = height;
+	packer->padding = padding;
+	packer->penX = padding;
+	packer->penY = padding;
+	packer->rowHeight = 0;
+}
+
+int atlas_packer_insert(AtlasPacker *packer, int width, int height, int *x, int *y) {
+	if (width + 2 * packer->padding > packer->width || height + 2 * packer->padding > packer->height)
+		return -1;
+
+	if (packer->penX + width + packer->padding > packer->width) {
+		packer->penX = packer->padding;
+		packer->penY += packer->rowHeight + packer->padding;
+		packer->rowHeight = 0;
+	}
+	if (packer->penY + height + packer->padding > packer->height)
+		return -1;
+
+	*x = packer->penX;
+	*y = packer->penY;
+	packer->penX += width + packer->padding;
+	if (height > packer->rowHeight)
+		packer->rowHeight = height;
+	return 0;
+}
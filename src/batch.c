@@ -0,0 +1,628 @@
+#define _USE_MATH_DEFINES
+#include "../libs/ck.h"
+#include "../libs/ck_internal.h"
+#include <stddef.h>
+
+StreamBuffer *stream_buffer_create(GLsizeiptr capacity, GLint components) {
+	return stream_buffer_create_attributes(capacity, &components, 1);
+}
+
+// Interleaved float attributes, attribute i has components[i] floats.
+StreamBuffer *stream_buffer_create_attributes(GLsizeiptr capacity, const GLint *components, int attributeCount) {
+	StreamBuffer *stream = malloc(sizeof(StreamBuffer));
+	if (!stream) {
+		fprintf(stderr, "Failed to allocate memory for StreamBuffer\n");
+		return NULL;
+	}
+	GLint total = 0;
+	for (int i = 0; i < attributeCount; i++)
+		total += components[i];
+	stream->capacity = capacity;
+	stream->offset = 0;
+	stream->stride = total * sizeof(GLfloat);
+
+	glGenVertexArrays(1, &stream->VAO);
+	glBindVertexArray(stream->VAO);
+	glGenBuffers(1, &stream->VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, stream->VBO);
+	glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+	GLint offset = 0;
+	for (int i = 0; i < attributeCount; i++) {
+		glEnableVertexAttribArray(i);
+		glVertexAttribPointer(i, components[i], GL_FLOAT, GL_FALSE, stream->stride, (void *)(offset * sizeof(GLfloat)));
+		offset += components[i];
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return stream;
+}
+
+void stream_buffer_destroy(StreamBuffer *stream) {
+	if (!stream) return;
+	glDeleteBuffers(1, &stream->VBO);
+	glDeleteVertexArrays(1, &stream->VAO);
+	free(stream);
+}
+
+// Appends the vertices to the ring and leaves the stream's VAO bound.
+// Returns the index of the first uploaded vertex, or -1 on failure.
+GLint stream_buffer_upload(StreamBuffer *stream, const void *data, GLsizeiptr size) {
+	if (!stream || !data || size <= 0) return -1;
+
+	glBindVertexArray(stream->VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, stream->VBO);
+
+	if (size > stream->capacity) {
+		while (stream->capacity < size)
+			stream->capacity *= 2;
+		glBufferData(GL_ARRAY_BUFFER, stream->capacity, NULL, GL_STREAM_DRAW);
+		stream->offset = 0;
+	} else if (stream->offset + size > stream->capacity) {
+		// Orphan the storage so the driver can hand out a fresh block while the GPU
+		// is still reading the previous one.
+		glBufferData(GL_ARRAY_BUFFER, stream->capacity, NULL, GL_STREAM_DRAW);
+		stream->offset = 0;
+	}
+
+	void *dst = glMapBufferRange(GL_ARRAY_BUFFER, stream->offset, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!dst) {
+		fprintf(stderr, "Failed to map stream buffer\n");
+		return -1;
+	}
+	memcpy(dst, data, size);
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+
+	GLint first = (GLint)(stream->offset / stream->stride);
+	stream->offset += (size + stream->stride - 1) / stream->stride * stream->stride;
+	return first;
+}
+
+TextBatch *text_batch_create() {
+	TextBatch *batch = calloc(1, sizeof(TextBatch));
+	if (!batch) {
+		fprintf(stderr, "Failed to allocate memory for TextBatch\n");
+		return NULL;
+	}
+	return batch;
+}
+
+void text_batch_destroy(TextBatch *batch) {
+	if (!batch) return;
+	free(batch->vertices);
+	free(batch->runs);
+	free(batch);
+}
+
+static inline int text_batch_reserve(TextBatch *batch, int vertices) {
+	if (batch->vertexCount + vertices <= batch->vertexCapacity)
+		return 0;
+	int capacity = batch->vertexCapacity ? batch->vertexCapacity : 6 * 256;
+	while (capacity < batch->vertexCount + vertices)
+		capacity *= 2;
+	GLfloat (*grown)[4] = realloc(batch->vertices, sizeof(*grown) * capacity);
+	if (!grown) {
+		fprintf(stderr, "Failed to allocate memory for text batch vertices\n");
+		return -1;
+	}
+	batch->vertices = grown;
+	batch->vertexCapacity = capacity;
+	return 0;
+}
+
+static inline TextRun *text_batch_run(TextBatch *batch, GLuint texture, const float color[3]) {
+	if (batch->runCount > 0) {
+		TextRun *last = &batch->runs[batch->runCount - 1];
+		if (last->texture == texture && last->color[0] == color[0] &&
+			last->color[1] == color[1] && last->color[2] == color[2])
+			return last;
+	}
+	if (batch->runCount == batch->runCapacity) {
+		int capacity = batch->runCapacity ? batch->runCapacity * 2 : 16;
+		TextRun *grown = realloc(batch->runs, sizeof(TextRun) * capacity);
+		if (!grown) {
+			fprintf(stderr, "Failed to allocate memory for text batch runs\n");
+			return NULL;
+		}
+		batch->runs = grown;
+		batch->runCapacity = capacity;
+	}
+	TextRun *run = &batch->runs[batch->runCount++];
+	run->texture = texture;
+	run->color[0] = color[0];
+	run->color[1] = color[1];
+	run->color[2] = color[2];
+	run->first = batch->vertexCount;
+	run->count = 0;
+	return run;
+}
+
+void text_batch_add_layout(TextBatch *batch, Shader *shader, const TextLayout *layout, float x, float y, const float color[3]) {
+	if (!batch || !layout || layout->count == 0) return;
+	batch->shader = shader;
+	if (text_batch_reserve(batch, layout->count * 6) != 0)
+		return;
+
+	for (int i = 0; i < layout->count; i++) {
+		const LayoutGlyph *glyph = &layout->glyphs[i];
+		TextRun *run = text_batch_run(batch, glyph->texture, color);
+		if (!run)
+			return;
+
+		float xpos = x + glyph->x;
+		float ypos = y + glyph->y;
+		float w = glyph->width;
+		float h = glyph->height;
+		float u0 = glyph->uv[0], v0 = glyph->uv[1];
+		float u1 = glyph->uv[2], v1 = glyph->uv[3];
+
+		GLfloat (*vertices)[4] = &batch->vertices[batch->vertexCount];
+		vertices[0][0] = xpos;     vertices[0][1] = ypos + h; vertices[0][2] = u0; vertices[0][3] = v0;
+		vertices[1][0] = xpos + w; vertices[1][1] = ypos;     vertices[1][2] = u1; vertices[1][3] = v1;
+		vertices[2][0] = xpos;     vertices[2][1] = ypos;     vertices[2][2] = u0; vertices[2][3] = v1;
+		vertices[3][0] = xpos;     vertices[3][1] = ypos + h; vertices[3][2] = u0; vertices[3][3] = v0;
+		vertices[4][0] = xpos + w; vertices[4][1] = ypos + h; vertices[4][2] = u1; vertices[4][3] = v0;
+		vertices[5][0] = xpos + w; vertices[5][1] = ypos;     vertices[5][2] = u1; vertices[5][3] = v1;
+		batch->vertexCount += 6;
+		run->count += 6;
+		batch->glyphCount++;
+	}
+}
+
+void text_batch_flush(TextBatch *batch, Window *win) {
+	if (!batch || !win) return;
+	if (batch->vertexCount == 0) {
+		batch->runCount = 0;
+		batch->glyphCount = 0;
+		return;
+	}
+
+	GLint first = stream_buffer_upload(win->quadStream, batch->vertices, sizeof(*batch->vertices) * batch->vertexCount);
+	if (first < 0) {
+		batch->vertexCount = 0;
+		batch->runCount = 0;
+		batch->glyphCount = 0;
+		return;
+	}
+
+	use_shader(batch->shader, win);
+	GLint colorLocation = batch->shader->uniforms[UNIFORM_TEXT_COLOR];
+
+	glActiveTexture(GL_TEXTURE0);
+	set_alpha_blend(win);
+
+	GLuint boundTexture = 0;
+	for (int i = 0; i < batch->runCount; i++) {
+		TextRun *run = &batch->runs[i];
+		if (run->texture != boundTexture) {
+			glBindTexture(GL_TEXTURE_2D, run->texture);
+			boundTexture = run->texture;
+		}
+		glUniform3fv(colorLocation, 1, run->color);
+		glDrawArrays(GL_TRIANGLES, first + run->first, run->count);
+	}
+
+	win->stats.drawCalls += batch->runCount;
+	win->stats.glyphCount += batch->glyphCount;
+	win->stats.drawCallsSaved += batch->glyphCount - batch->runCount;
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glUseProgram(0);
+
+	batch->vertexCount = 0;
+	batch->runCount = 0;
+	batch->glyphCount = 0;
+}
+
+LineBatch *line_batch_create() {
+	LineBatch *batch = calloc(1, sizeof(LineBatch));
+	if (!batch) {
+		fprintf(stderr, "Failed to allocate memory for LineBatch\n");
+		return NULL;
+	}
+	return batch;
+}
+
+void line_batch_destroy(LineBatch *batch) {
+	if (!batch) return;
+	free(batch->vertices);
+	free(batch->strokeVertices);
+	free(batch->runs);
+	free(batch);
+}
+
+static Position unit_circle[LINE_CAP_SEGMENTS + 1];
+
+static const Position *line_cap_table() {
+	static bool initialized = false;
+	if (!initialized) {
+		for (int i = 0; i <= LINE_CAP_SEGMENTS; i++) {
+			float angle = (float)i / LINE_CAP_SEGMENTS * 2.0f * (float)M_PI;
+			unit_circle[i] = (Position){ cosf(angle), sinf(angle) };
+		}
+		initialized = true;
+	}
+	return unit_circle;
+}
+
+void line_batch_begin(LineBatch *batch, bool sdf, Position origin) {
+	if (!batch) return;
+	batch->sdf = sdf;
+	batch->origin = origin;
+	batch->vertexCount = 0;
+	batch->runCount = 0;
+	batch->lineCount = 0;
+}
+
+static inline int line_batch_reserve(LineBatch *batch, int count) {
+	if (batch->sdf) {
+		if (batch->vertexCount + count > batch->strokeCapacity) {
+			int capacity = batch->strokeCapacity ? batch->strokeCapacity : 6 * 256;
+			while (capacity < batch->vertexCount + count)
+				capacity *= 2;
+			StrokeVertex *vertices = realloc(batch->strokeVertices, sizeof(StrokeVertex) * capacity);
+			if (!vertices) {
+				fprintf(stderr, "Failed to allocate memory for stroke vertices\n");
+				return -1;
+			}
+			batch->strokeVertices = vertices;
+			batch->strokeCapacity = capacity;
+		}
+	} else if (batch->vertexCount + count > batch->vertexCapacity) {
+		int capacity = batch->vertexCapacity ? batch->vertexCapacity : LINE_VERTEX_COUNT * 64;
+		while (capacity < batch->vertexCount + count)
+			capacity *= 2;
+		Position *vertices = realloc(batch->vertices, sizeof(Position) * capacity);
+		if (!vertices) {
+			fprintf(stderr, "Failed to allocate memory for line vertices\n");
+			return -1;
+		}
+		batch->vertices = vertices;
+		batch->vertexCapacity = capacity;
+	}
+	if (batch->runCount == batch->runCapacity) {
+		int capacity = batch->runCapacity ? batch->runCapacity * 2 : 16;
+		LineRun *runs = realloc(batch->runs, sizeof(LineRun) * capacity);
+		if (!runs) {
+			fprintf(stderr, "Failed to allocate memory for line runs\n");
+			return -1;
+		}
+		batch->runs = runs;
+		batch->runCapacity = capacity;
+	}
+	return 0;
+}
+
+static inline void line_batch_cap(LineBatch *batch, Position center, float radius) {
+	const Position *circle = line_cap_table();
+	Position *v = &batch->vertices[batch->vertexCount];
+	for (int i = 0; i < LINE_CAP_SEGMENTS; i++) {
+		*v++ = center;
+		*v++ = (Position){ center.x + circle[i].x * radius, center.y + circle[i].y * radius };
+		*v++ = (Position){ center.x + circle[i + 1].x * radius, center.y + circle[i + 1].y * radius };
+	}
+	batch->vertexCount += LINE_CAP_SEGMENTS * 3;
+}
+
+// One quad per segment, grown by the radius plus a pixel for the antialiased edge.
+// The stroke shader cuts the capsule out of it.
+static inline void line_batch_capsule(LineBatch *batch, const Line *line) {
+	float radius = line->thickness * 0.5f;
+	float extent = radius + 1.0f;
+	float dx = line->end.x - line->start.x;
+	float dy = line->end.y - line->start.y;
+	float length = sqrtf(dx * dx + dy * dy);
+	if (length > 0) {
+		dx /= length;
+		dy /= length;
+	} else {
+		dx = 1.0f;
+		dy = 0.0f;
+	}
+	float alongX = dx * extent, alongY = dy * extent;
+	float perpX = -dy * extent, perpY = dx * extent;
+
+	Position corners[4] = {
+		{ line->start.x - alongX + perpX, line->start.y - alongY + perpY },
+		{ line->start.x - alongX - perpX, line->start.y - alongY - perpY },
+		{ line->end.x + alongX - perpX, line->end.y + alongY - perpY },
+		{ line->end.x + alongX + perpX, line->end.y + alongY + perpY }
+	};
+	static const int order[6] = { 0, 1, 3, 1, 2, 3 };
+
+	StrokeVertex *v = &batch->strokeVertices[batch->vertexCount];
+	for (int i = 0; i < 6; i++) {
+		v[i] = (StrokeVertex){
+			.position = { corners[order[i]].x, corners[order[i]].y },
+			.segment = { line->start.x, line->start.y, line->end.x, line->end.y },
+			.radius = radius
+		};
+	}
+	batch->vertexCount += 6;
+}
+
+void line_batch_add(LineBatch *batch, const Line *source) {
+	if (!batch || !source) return;
+	Line shifted = *source;
+	shifted.start.x -= batch->origin.x;
+	shifted.start.y -= batch->origin.y;
+	shifted.end.x -= batch->origin.x;
+	shifted.end.y -= batch->origin.y;
+	const Line *line = &shifted;
+	if (line_batch_reserve(batch, batch->sdf ? 6 : LINE_VERTEX_COUNT) != 0)
+		return;
+
+	// Lines keep their queue order, a new run starts whenever the blend state or colour changes.
+	LineRun *run = batch->runCount ? &batch->runs[batch->runCount - 1] : NULL;
+	bool continues = run && run->erase == line->erase && memcmp(run->color, line->color, sizeof(run->color)) == 0;
+	if (!continues) {
+		run = &batch->runs[batch->runCount++];
+		memcpy(run->color, line->color, sizeof(run->color));
+		run->erase = line->erase;
+		run->first = batch->vertexCount;
+		run->count = 0;
+	}
+
+	int first = batch->vertexCount;
+	if (batch->sdf) {
+		line_batch_capsule(batch, line);
+		run->count += batch->vertexCount - first;
+		batch->lineCount++;
+		return;
+	}
+
+	float dx = line->start.x - line->end.x;
+	float dy = line->start.y - line->end.y;
+	float length = sqrtf(dx * dx + dy * dy);
+
+	if (length > 0) {
+		float perpX = -dy / length * line->thickness * 0.5f;
+		float perpY = dx / length * line->thickness * 0.5f;
+		Position *v = &batch->vertices[batch->vertexCount];
+
+		v[0] = (Position){ line->start.x + perpX, line->start.y + perpY };
+		v[1] = (Position){ line->start.x - perpX, line->start.y - perpY };
+		v[2] = (Position){ line->end.x + perpX, line->end.y + perpY };
+
+		v[3] = (Position){ line->start.x - perpX, line->start.y - perpY };
+		v[4] = (Position){ line->end.x - perpX, line->end.y - perpY };
+		v[5] = (Position){ line->end.x + perpX, line->end.y + perpY };
+		batch->vertexCount += 6;
+	}
+
+	float radius = line->thickness * 0.5f;
+	// Freehand strokes arrive as connected segments, the previous end cap already covers this start.
+	bool shared = continues && line->thickness == batch->lastThickness &&
+		line->start.x == batch->lastEnd.x && line->start.y == batch->lastEnd.y;
+	if (!shared)
+		line_batch_cap(batch, line->start, radius);
+	line_batch_cap(batch, line->end, radius);
+
+	run->count += batch->vertexCount - first;
+	batch->lastEnd = line->end;
+	batch->lastThickness = line->thickness;
+	batch->lineCount++;
+}
+
+// Consecutive segments share their joint cap, which makes a round join.
+void line_batch_add_polyline(LineBatch *batch, const Position *points, const Polyline *polyline) {
+	if (!batch || !polyline || polyline->count <= 0) return;
+	const Position *p = &points[polyline->first];
+
+	Line line = {
+		.start = p[0],
+		.end = p[0],
+		.thickness = polyline->thickness,
+		.color = { polyline->color[0], polyline->color[1], polyline->color[2] },
+		.erase = polyline->erase
+	};
+	bool drawn = false;
+	for (int i = 1; i < polyline->count; i++) {
+		if (p[i].x == line.start.x && p[i].y == line.start.y)
+			continue;
+		line.end = p[i];
+		line_batch_add(batch, &line);
+		line.start = line.end;
+		drawn = true;
+	}
+	// Every point coincides, leave a dot.
+	if (!drawn)
+		line_batch_add(batch, &line);
+}
+
+void line_batch_flush(LineBatch *batch, Shader *shader, Window *win) {
+	if (!batch || !win) return;
+	if (batch->vertexCount == 0) {
+		batch->runCount = 0;
+		batch->lineCount = 0;
+		return;
+	}
+
+	GLint first = batch->sdf
+		? stream_buffer_upload(win->strokeStream, batch->strokeVertices, sizeof(StrokeVertex) * batch->vertexCount)
+		: stream_buffer_upload(win->lineStream, batch->vertices, sizeof(Position) * batch->vertexCount);
+	if (first < 0) {
+		batch->vertexCount = 0;
+		batch->runCount = 0;
+		batch->lineCount = 0;
+		return;
+	}
+
+	use_shader(shader, win);
+	glEnable(GL_BLEND);
+
+	for (int i = 0; i < batch->runCount; i++) {
+		LineRun *run = &batch->runs[i];
+		glUniform3fv(shader->uniforms[UNIFORM_LINE_COLOR], 1, run->color);
+		glUniform1i(shader->uniforms[UNIFORM_ERASE], run->erase);
+		if (run->erase)
+			// The stroke shader outputs coverage, erase only as much of the edge as it covers.
+			glBlendFunc(GL_ZERO, batch->sdf ? GL_ONE_MINUS_SRC_ALPHA : GL_ZERO);
+		else
+			set_alpha_blend(win);
+		glDrawArrays(GL_TRIANGLES, first + run->first, run->count);
+	}
+
+	win->stats.drawCalls += batch->runCount;
+	win->stats.drawCallsSaved += batch->lineCount - batch->runCount;
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glUseProgram(0);
+
+	batch->vertexCount = 0;
+	batch->runCount = 0;
+	batch->lineCount = 0;
+}
+
+InstanceBatch *instance_batch_create() {
+	InstanceBatch *batch = calloc(1, sizeof(InstanceBatch));
+	if (!batch) {
+		fprintf(stderr, "Failed to allocate memory for InstanceBatch\n");
+		return NULL;
+	}
+
+	static const GLfloat corners[6][2] = {
+		{ 0.0f, 1.0f }, { 1.0f, 0.0f }, { 0.0f, 0.0f },
+		{ 0.0f, 1.0f }, { 1.0f, 1.0f }, { 1.0f, 0.0f }
+	};
+
+	glGenVertexArrays(1, &batch->VAO);
+	glBindVertexArray(batch->VAO);
+
+	glGenBuffers(1, &batch->quadVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, batch->quadVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0);
+
+	glGenBuffers(1, &batch->instanceVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, batch->instanceVBO);
+	glEnableVertexAttribArray(1);
+	glVertexAttribDivisor(1, 1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(3);
+	glVertexAttribDivisor(3, 1);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return batch;
+}
+
+void instance_batch_destroy(InstanceBatch *batch) {
+	if (!batch) return;
+	glDeleteBuffers(1, &batch->quadVBO);
+	glDeleteBuffers(1, &batch->instanceVBO);
+	glDeleteVertexArrays(1, &batch->VAO);
+	free(batch->instances);
+	free(batch->sorted);
+	free(batch->groups);
+	free(batch);
+}
+
+void instance_batch_add(InstanceBatch *batch, const Skin *skin, float x, float y, float width, float height, const float tint[3], float intensity) {
+	if (!batch) return;
+	if (batch->count == batch->capacity) {
+		int capacity = batch->capacity ? batch->capacity * 2 : 64;
+		QuadInstance *instances = realloc(batch->instances, sizeof(QuadInstance) * capacity);
+		if (!instances) {
+			fprintf(stderr, "Failed to allocate memory for quad instances\n");
+			return;
+		}
+		batch->instances = instances;
+		QuadInstance *sorted = realloc(batch->sorted, sizeof(QuadInstance) * capacity);
+		if (!sorted) {
+			fprintf(stderr, "Failed to allocate memory for quad instances\n");
+			return;
+		}
+		batch->sorted = sorted;
+		batch->capacity = capacity;
+	}
+	batch->instances[batch->count++] = (QuadInstance){
+		.rect = { x, y, width, height },
+		.tint = { tint[0], tint[1], tint[2], intensity },
+		.uv = { skin->uv[0], skin->uv[1], skin->uv[2], skin->uv[3] },
+		.texture = skin->texture
+	};
+}
+
+static inline InstanceGroup *instance_batch_group(InstanceBatch *batch, GLuint texture) {
+	for (int i = 0; i < batch->groupCount; i++) {
+		if (batch->groups[i].texture == texture)
+			return &batch->groups[i];
+	}
+	if (batch->groupCount == batch->groupCapacity) {
+		int capacity = batch->groupCapacity ? batch->groupCapacity * 2 : 8;
+		InstanceGroup *groups = realloc(batch->groups, sizeof(InstanceGroup) * capacity);
+		if (!groups) {
+			fprintf(stderr, "Failed to allocate memory for instance groups\n");
+			return NULL;
+		}
+		batch->groups = groups;
+		batch->groupCapacity = capacity;
+	}
+	InstanceGroup *group = &batch->groups[batch->groupCount++];
+	group->texture = texture;
+	group->first = 0;
+	group->count = 0;
+	return group;
+}
+
+void instance_batch_flush(InstanceBatch *batch, Shader *shader, Window *win) {
+	if (!batch || batch->count == 0) return;
+
+	// Counting sort by texture (atlas page), keeps submission order inside each group.
+	batch->groupCount = 0;
+	for (int i = 0; i < batch->count; i++) {
+		InstanceGroup *group = instance_batch_group(batch, batch->instances[i].texture);
+		if (!group) {
+			batch->count = 0;
+			return;
+		}
+		group->count++;
+	}
+	int offset = 0;
+	for (int i = 0; i < batch->groupCount; i++) {
+		batch->groups[i].first = offset;
+		offset += batch->groups[i].count;
+		batch->groups[i].count = 0;
+	}
+	for (int i = 0; i < batch->count; i++) {
+		InstanceGroup *group = instance_batch_group(batch, batch->instances[i].texture);
+		batch->sorted[group->first + group->count++] = batch->instances[i];
+	}
+
+	GLsizeiptr size = sizeof(QuadInstance) * batch->count;
+	glBindVertexArray(batch->VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, batch->instanceVBO);
+	if (size > batch->instanceCapacity) {
+		batch->instanceCapacity = size;
+	}
+	// Orphan last frame's instances before writing this frame's.
+	glBufferData(GL_ARRAY_BUFFER, batch->instanceCapacity, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, size, batch->sorted);
+
+	use_shader(shader, win);
+	glActiveTexture(GL_TEXTURE0);
+	set_alpha_blend(win);
+
+	for (int i = 0; i < batch->groupCount; i++) {
+		InstanceGroup *group = &batch->groups[i];
+		GLintptr base = sizeof(QuadInstance) * group->first;
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(QuadInstance), (void *)(base + offsetof(QuadInstance, rect)));
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(QuadInstance), (void *)(base + offsetof(QuadInstance, tint)));
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(QuadInstance), (void *)(base + offsetof(QuadInstance, uv)));
+		glBindTexture(GL_TEXTURE_2D, group->texture);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 6, group->count);
+	}
+
+	win->stats.drawCalls += batch->groupCount;
+	win->stats.drawCallsSaved += batch->count - batch->groupCount;
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glUseProgram(0);
+	batch->count = 0;
+}
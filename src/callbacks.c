@@ -22,9 +22,18 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 	if (win) {
 		win->width = width;
 		win->height = height;
+		invalidate_window(win);
 	}
 }
 
+void window_refresh_callback(GLFWwindow* window) {
+	Ck *ck = (Ck *)glfwGetWindowUserPointer(window);
+
+	for (size_t i = 0; i < ck->window_count; i++)
+		if (ck->windows[i]->window == window)
+			invalidate_window(ck->windows[i]);
+}
+
 void window_close_callback(GLFWwindow* window) {
 	Ck *ck = (Ck *)glfwGetWindowUserPointer(window);
 
@@ -45,8 +54,78 @@ void debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsi
 	fprintf(stderr, "GL_DEBUG: Source: %d, Type: %d, ID: %d, Severity: %d, Message: %s\n", source, type, id, severity, message);
 }
 
-void mousebutton_callback(GLFWwindow *window, int button, int action, int mods) {
+static Window *find_window(GLFWwindow *window) {
 	Ck *ck = (Ck *)glfwGetWindowUserPointer(window);
-	if (action == GLFW_PRESS)
-		signal_emit(ck, CLICK);
-}
\ No newline at end of file
+	if (!ck) return NULL;
+	for (int i = 0; i < ck->window_count; i++)
+		if (ck->windows[i]->window == window)
+			return ck->windows[i];
+	return NULL;
+}
+
+static InputEvent *push_input_event(Window *win, enum INPUT_EVENT type) {
+	if (win->eventCount == win->eventCapacity) {
+		int capacity = win->eventCapacity ? win->eventCapacity * 2 : 32;
+		InputEvent *events = realloc(win->events, sizeof(InputEvent) * capacity);
+		if (!events) {
+			fprintf(stderr, "Failed to allocate memory for input events\n");
+			return NULL;
+		}
+		win->events = events;
+		win->eventCapacity = capacity;
+	}
+	InputEvent *event = &win->events[win->eventCount++];
+	memset(event, 0, sizeof(InputEvent));
+	event->type = type;
+	event->time = glfwGetTime();
+	event->position = mouse_position(win);
+	return event;
+}
+
+void cursor_position_callback(GLFWwindow *window, double x, double y) {
+	Window *win = find_window(window);
+	if (!win) return;
+	// Only the latest position matters until a button or key event comes in between.
+	InputEvent *event = win->eventCount > 0 && win->events[win->eventCount - 1].type == INPUT_CURSOR ?
+		&win->events[win->eventCount - 1] : push_input_event(win, INPUT_CURSOR);
+	if (!event) return;
+	event->time = glfwGetTime();
+	event->position.x = (int)x;
+	event->position.y = win->height - (int)y;
+}
+
+void cursor_enter_callback(GLFWwindow *window, int entered) {
+	Window *win = find_window(window);
+	if (win)
+		push_input_event(win, entered ? INPUT_CURSOR : INPUT_CURSOR_LEAVE);
+}
+
+void mousebutton_callback(GLFWwindow *window, int button, int action, int mods) {
+	Window *win = find_window(window);
+	if (!win) return;
+	InputEvent *event = push_input_event(win, INPUT_BUTTON);
+	if (!event) return;
+	event->button = button;
+	event->action = action;
+	event->mods = mods;
+}
+
+void scroll_callback(GLFWwindow *window, double x, double y) {
+	Window *win = find_window(window);
+	if (!win) return;
+	InputEvent *event = push_input_event(win, INPUT_SCROLL);
+	if (!event) return;
+	event->scroll[0] = x;
+	event->scroll[1] = y;
+}
+
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+	Window *win = find_window(window);
+	if (!win) return;
+	InputEvent *event = push_input_event(win, INPUT_KEY);
+	if (!event) return;
+	event->key = key;
+	event->scancode = scancode;
+	event->action = action;
+	event->mods = mods;
+}
@@ -0,0 +1,393 @@
+#include "../libs/ck.h"
+#include "../libs/ck_internal.h"
+
+#define COLLINEAR_EPSILON 0.05f // pixels a point may sit off a straight run and still be merged
+
+static inline float segment_distance_squared(Position p, Position a, Position b) {
+	float abx = b.x - a.x, aby = b.y - a.y;
+	float apx = p.x - a.x, apy = p.y - a.y;
+	float length = abx * abx + aby * aby;
+	float t = length > 0 ? (apx * abx + apy * aby) / length : 0.0f;
+	t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+	float dx = apx - abx * t, dy = apy - aby * t;
+	return dx * dx + dy * dy;
+}
+
+static inline bool collinear(Position a, Position b, Position c) {
+	float abx = b.x - a.x, aby = b.y - a.y;
+	float bcx = c.x - b.x, bcy = c.y - b.y;
+	// A stroke that doubles back is not a straight run.
+	if (abx * bcx + aby * bcy < 0.0f)
+		return false;
+	return segment_distance_squared(b, a, c) <= COLLINEAR_EPSILON * COLLINEAR_EPSILON;
+}
+
+static int ensure_scratch(CommandBuffer *buffer, int count) {
+	if (count <= buffer->scratchCapacity)
+		return 0;
+	unsigned char *keep = realloc(buffer->keep, count);
+	if (!keep) {
+		fprintf(stderr, "Failed to allocate memory for stroke simplification\n");
+		return -1;
+	}
+	buffer->keep = keep;
+	int *stack = realloc(buffer->stack, sizeof(int) * 2 * count);
+	if (!stack) {
+		fprintf(stderr, "Failed to allocate memory for stroke simplification\n");
+		return -1;
+	}
+	buffer->stack = stack;
+	buffer->scratchCapacity = count;
+	return 0;
+}
+
+// Ramer-Douglas-Peucker without recursion, keeps the points that deviate more than tolerance.
+static int douglas_peucker(CommandBuffer *buffer, Position *p, int count, float tolerance) {
+	if (ensure_scratch(buffer, count) != 0)
+		return count;
+	unsigned char *keep = buffer->keep;
+	int *stack = buffer->stack;
+	memset(keep, 0, count);
+	keep[0] = keep[count - 1] = 1;
+
+	float limit = tolerance * tolerance;
+	int top = 0;
+	stack[top++] = 0;
+	stack[top++] = count - 1;
+	while (top > 0) {
+		int end = stack[--top];
+		int start = stack[--top];
+		float farthest = 0.0f;
+		int index = -1;
+		for (int i = start + 1; i < end; i++) {
+			float distance = segment_distance_squared(p[i], p[start], p[end]);
+			if (distance > farthest) {
+				farthest = distance;
+				index = i;
+			}
+		}
+		if (index >= 0 && farthest > limit) {
+			keep[index] = 1;
+			stack[top++] = start;
+			stack[top++] = index;
+			stack[top++] = index;
+			stack[top++] = end;
+		}
+	}
+
+	int kept = 0;
+	for (int i = 0; i < count; i++) {
+		if (keep[i])
+			p[kept++] = p[i];
+	}
+	return kept;
+}
+
+// Simplifies the points in place and returns how many are left. The first and last point always stay.
+static int simplify_points(CommandBuffer *buffer, Position *p, int count, float minSegment, float tolerance) {
+	if (count <= 2)
+		return count;
+
+	float minimum = minSegment * minSegment;
+	int n = 1;
+	for (int i = 1; i < count; i++) {
+		float dx = p[i].x - p[n - 1].x, dy = p[i].y - p[n - 1].y;
+		if (dx * dx + dy * dy < minimum) {
+			if (i < count - 1)
+				continue;
+			// The stroke must still end where it ended, move the previous point instead.
+			if (n > 1) {
+				p[n - 1] = p[i];
+				continue;
+			}
+		}
+		p[n++] = p[i];
+	}
+
+	int m = 1;
+	for (int i = 1; i < n - 1; i++) {
+		if (!collinear(p[m - 1], p[i], p[i + 1]))
+			p[m++] = p[i];
+	}
+	p[m++] = p[n - 1];
+
+	if (tolerance > 0.0f && m > 2)
+		m = douglas_peucker(buffer, p, m, tolerance);
+	return m;
+}
+
+static inline bool continues_line(const Line *previous, const Line *line) {
+	return line->start.x == previous->end.x && line->start.y == previous->end.y &&
+		line->thickness == previous->thickness && line->erase == previous->erase &&
+		memcmp(line->color, previous->color, sizeof(line->color)) == 0;
+}
+
+void command_buffer_simplify(CommandBuffer *buffer, float minSegment, float tolerance) {
+	int write = 0;
+	int read = 0;
+	while (read < buffer->count) {
+		CanvasCommand *command = &buffer->commands[read];
+
+		if (command->type == CANVAS_POLYLINE) {
+			Polyline polyline = command->polyline;
+			polyline.count = simplify_points(buffer, &buffer->points[polyline.first], polyline.count, minSegment, tolerance);
+			buffer->commands[write].type = CANVAS_POLYLINE;
+			buffer->commands[write].polyline = polyline;
+			write++;
+			read++;
+			continue;
+		}
+		if (command->type != CANVAS_LINE) {
+			buffer->commands[write++] = *command;
+			read++;
+			continue;
+		}
+
+		// Chains of single segments, as pen input sends them, become one polyline.
+		int end = read + 1;
+		while (end < buffer->count && buffer->commands[end].type == CANVAS_LINE &&
+			continues_line(&buffer->commands[end - 1].line, &buffer->commands[end].line))
+			end++;
+		if (end - read < 2) {
+			buffer->commands[write++] = *command;
+			read++;
+			continue;
+		}
+
+		Line first = command->line;
+		Polyline polyline = {
+			.first = buffer->pointCount,
+			.count = end - read + 1,
+			.thickness = first.thickness,
+			.color = { first.color[0], first.color[1], first.color[2] },
+			.erase = first.erase
+		};
+		bool pushed = command_buffer_push_points(buffer, &first.start, 1) != NULL;
+		for (int i = read; pushed && i < end; i++)
+			pushed = command_buffer_push_points(buffer, &buffer->commands[i].line.end, 1) != NULL;
+		if (!pushed) {
+			// Out of memory, the remaining commands move down unsimplified.
+			buffer->pointCount = polyline.first;
+			memmove(&buffer->commands[write], &buffer->commands[read], (buffer->count - read) * sizeof(CanvasCommand));
+			write += buffer->count - read;
+			break;
+		}
+		polyline.count = simplify_points(buffer, &buffer->points[polyline.first], polyline.count, minSegment, tolerance);
+		buffer->pointCount = polyline.first + polyline.count;
+
+		buffer->commands[write].type = CANVAS_POLYLINE;
+		buffer->commands[write].polyline = polyline;
+		write++;
+		read = end;
+	}
+	buffer->count = write;
+}
+
+// Bounding box of the pixels a command can touch, min x, min y, max x, max y.
+bool canvas_command_bounds(const CommandBuffer *buffer, const CanvasCommand *command, float bounds[4]) {
+	float radius;
+	switch (command->type) {
+	case CANVAS_LINE:
+		bounds[0] = fminf(command->line.start.x, command->line.end.x);
+		bounds[1] = fminf(command->line.start.y, command->line.end.y);
+		bounds[2] = fmaxf(command->line.start.x, command->line.end.x);
+		bounds[3] = fmaxf(command->line.start.y, command->line.end.y);
+		radius = command->line.thickness * 0.5f;
+		break;
+	case CANVAS_POLYLINE: {
+		const Position *p = &buffer->points[command->polyline.first];
+		if (command->polyline.count <= 0)
+			return false;
+		bounds[0] = bounds[2] = p[0].x;
+		bounds[1] = bounds[3] = p[0].y;
+		for (int i = 1; i < command->polyline.count; i++) {
+			bounds[0] = fminf(bounds[0], p[i].x);
+			bounds[1] = fminf(bounds[1], p[i].y);
+			bounds[2] = fmaxf(bounds[2], p[i].x);
+			bounds[3] = fmaxf(bounds[3], p[i].y);
+		}
+		radius = command->polyline.thickness * 0.5f;
+		break;
+	}
+	default:
+		return false;
+	}
+	// one more pixel for the antialiased edge of SDF strokes
+	radius += 1.0f;
+	bounds[0] -= radius;
+	bounds[1] -= radius;
+	bounds[2] += radius;
+	bounds[3] += radius;
+	return true;
+}
+
+static inline bool command_erases(const CanvasCommand *command) {
+	return command->type == CANVAS_LINE ? command->line.erase : command->polyline.erase;
+}
+
+// Adds the commands to the batch, only those overlapping clip when it is given.
+void add_canvas_commands(LineBatch *batch, const CommandBuffer *buffer, const float clip[4]) {
+	for (int i = 0; i < buffer->count; i++) {
+		const CanvasCommand *command = &buffer->commands[i];
+		float bounds[4];
+		if (clip) {
+			if (!canvas_command_bounds(buffer, command, bounds))
+				continue;
+			if (bounds[2] < clip[0] || bounds[0] > clip[2] || bounds[3] < clip[1] || bounds[1] > clip[3])
+				continue;
+		}
+		switch (command->type) {
+		case CANVAS_LINE:
+			line_batch_add(batch, &command->line);
+			break;
+		case CANVAS_POLYLINE:
+			line_batch_add_polyline(batch, buffer->points, &command->polyline);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static CanvasTile *create_canvas_tile(canvasData *canvas, int level, int x, int y) {
+	CanvasTile *tile = malloc(sizeof(CanvasTile));
+	if (!tile) {
+		fprintf(stderr, "Failed to allocate memory for canvas tile\n");
+		return NULL;
+	}
+	tile->level = level;
+	tile->x = x;
+	tile->y = y;
+	tile->touched = false;
+	tile->texture = generate_texture(CANVAS_TILE_SIZE, CANVAS_TILE_SIZE, NULL);
+
+	glGenFramebuffers(1, &tile->FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, tile->FBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tile->texture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Framebuffer is not complete\n");
+		glDeleteFramebuffers(1, &tile->FBO);
+		glDeleteTextures(1, &tile->texture);
+		free(tile);
+		return NULL;
+	}
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	if (hashmap_insert(canvas->tiles, tile_key(level, x, y), tile) != 0) {
+		glDeleteFramebuffers(1, &tile->FBO);
+		glDeleteTextures(1, &tile->texture);
+		free(tile);
+		return NULL;
+	}
+	return tile;
+}
+
+int touch_tile(canvasData *canvas, CanvasTile *tile) {
+	if (tile->touched)
+		return 0;
+	if (canvas->touchedCount == canvas->touchedCapacity) {
+		int capacity = canvas->touchedCapacity ? canvas->touchedCapacity * 2 : 16;
+		CanvasTile **touched = realloc(canvas->touched, sizeof(CanvasTile *) * capacity);
+		if (!touched) {
+			fprintf(stderr, "Failed to allocate memory for touched tiles\n");
+			return -1;
+		}
+		canvas->touched = touched;
+		canvas->touchedCapacity = capacity;
+	}
+	canvas->touched[canvas->touchedCount++] = tile;
+	tile->touched = true;
+	return 0;
+}
+
+// Routes the queued commands to the tiles they cross, allocating tiles that paint lands on,
+// and draws each touched tile with the commands overlapping it. The ancestors of those
+// tiles are queued after them in canvas->touched, see update_canvas_pyramid.
+void rasterize_canvas_tiles(Window *win, canvasData *canvas, const CommandBuffer *buffer, Size size, bool sdf) {
+	int columns = (size.width + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE;
+	int rows = (size.height + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE;
+	canvas->touchedCount = 0;
+
+	for (int i = 0; i < buffer->count; i++) {
+		const CanvasCommand *command = &buffer->commands[i];
+		float bounds[4];
+		if (!canvas_command_bounds(buffer, command, bounds))
+			continue;
+		int x0 = (int)floorf(bounds[0] / CANVAS_TILE_SIZE), x1 = (int)floorf(bounds[2] / CANVAS_TILE_SIZE);
+		int y0 = (int)floorf(bounds[1] / CANVAS_TILE_SIZE), y1 = (int)floorf(bounds[3] / CANVAS_TILE_SIZE);
+		x0 = x0 < 0 ? 0 : x0;
+		y0 = y0 < 0 ? 0 : y0;
+		x1 = x1 >= columns ? columns - 1 : x1;
+		y1 = y1 >= rows ? rows - 1 : y1;
+
+		bool erase = command_erases(command);
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				CanvasTile *tile = hashmap_get(canvas->tiles, tile_key(0, x, y));
+				// Erasing blank space needs no tile.
+				if (!tile && !erase)
+					tile = create_canvas_tile(canvas, 0, x, y);
+				if (tile && touch_tile(canvas, tile) != 0)
+					return;
+			}
+		}
+	}
+
+	if (canvas->history.budget > 0)
+		record_canvas_tiles(canvas);
+
+	// Tiles hold premultiplied colour, so the pyramid can average them with linear filtering.
+	Shader *shader = sdf ? win->shaderPrograms[4] : win->shaderPrograms[2];
+	bool offscreen = win->offscreen;
+	win->offscreen = true;
+	glViewport(0, 0, CANVAS_TILE_SIZE, CANVAS_TILE_SIZE);
+	set_frame_size(win, CANVAS_TILE_SIZE, CANVAS_TILE_SIZE);
+	for (int i = 0; i < canvas->touchedCount; i++) {
+		CanvasTile *tile = canvas->touched[i];
+		float clip[4] = {
+			(float)tile->x * CANVAS_TILE_SIZE,
+			(float)tile->y * CANVAS_TILE_SIZE,
+			(float)(tile->x + 1) * CANVAS_TILE_SIZE,
+			(float)(tile->y + 1) * CANVAS_TILE_SIZE
+		};
+		glBindFramebuffer(GL_FRAMEBUFFER, tile->FBO);
+		line_batch_begin(win->lineBatch, sdf, (Position){ clip[0], clip[1] });
+		add_canvas_commands(win->lineBatch, buffer, clip);
+		line_batch_flush(win->lineBatch, shader, win);
+	}
+	win->offscreen = offscreen;
+
+	queue_canvas_ancestors(canvas);
+}
+
+// Breadth first, so every tile comes after all of its touched children.
+void queue_canvas_ancestors(canvasData *canvas) {
+	for (int i = 0; i < canvas->touchedCount; i++) {
+		CanvasTile *tile = canvas->touched[i];
+		if (tile->level + 1 >= CANVAS_PYRAMID_LEVELS)
+			continue;
+		int level = tile->level + 1, x = tile->x >> 1, y = tile->y >> 1;
+		CanvasTile *parent = hashmap_get(canvas->tiles, tile_key(level, x, y));
+		if (!parent)
+			parent = create_canvas_tile(canvas, level, x, y);
+		if (parent && touch_tile(canvas, parent) != 0)
+			return;
+	}
+}
+
+void destroy_canvas_tiles(canvasData *canvas) {
+	if (canvas->tiles) {
+		size_t iterator = 0;
+		CanvasTile *tile;
+		while (hashmap_next(canvas->tiles, &iterator, NULL, (void **)&tile)) {
+			glDeleteFramebuffers(1, &tile->FBO);
+			glDeleteTextures(1, &tile->texture);
+			free(tile);
+		}
+		hashmap_destroy(canvas->tiles);
+		canvas->tiles = NULL;
+	}
+	free(canvas->touched);
+	canvas->touched = NULL;
+}
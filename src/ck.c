@@ -25,8 +25,18 @@ Ck *initCK() {
 	}
 
 	ck->ft = ft;
+	ck->fonts = hashmap_create(16);
+	if (!ck->fonts) {
+		FT_Done_FreeType(ft);
+		glfwTerminate();
+		free(ck);
+		return NULL;
+	}
 	ck->window_count = 0;
 	ck->windows = NULL;
+	ck->render_mode = RENDER_CONTINUOUS;
+	ck->wait_timeout = 0.0;
+	ck->exporter = NULL;
 
 	glfwSetErrorCallback(error_callback);
 	return ck;
@@ -34,6 +44,8 @@ Ck *initCK() {
 
 void destroyCK(Ck *ck) {
 	if (ck) {
+		destroy_exporter(ck->exporter);
+		destroy_font_cache(ck->fonts);
 		if (ck->ft) {
 			FT_Done_FreeType(ck->ft);
 		}
@@ -49,15 +61,39 @@ int loopCK(Ck *ck) {
 	}
 
 	while (ck->window_count) {
+		bool pending = false;
 		for (int i = 0; i < ck->window_count; i++) {
-			if (render_window(ck->windows[i]) != 0) {
+			Window *win = ck->windows[i];
+			dispatch_input_events(win);
+			if (ck->render_mode == RENDER_ON_DEMAND && !window_needs_redraw(win))
+				continue;
+			if (render_window(win) != 0) {
 				fprintf(stderr, "Failed to render window\n");
 				return -1;
 			}
-			mouse_state_check(ck->windows[i]);
-			glfwSwapBuffers(ck->windows[i]->window);
+			glfwSwapBuffers(win->window);
+			// REDRAW handlers may have invalidated something again
+			pending |= window_needs_redraw(win);
 		}
-		glfwPollEvents();
+
+		// Readbacks are polled for completion, finished encodes wake the loop themselves.
+		poll_exports(ck);
+		pending |= exports_reading(ck);
+
+		if (ck->render_mode == RENDER_CONTINUOUS || pending)
+			glfwPollEvents();
+		else if (ck->wait_timeout > 0.0)
+			glfwWaitEventsTimeout(ck->wait_timeout);
+		else
+			glfwWaitEvents();
 	}
 	return 0;
+}
+
+void set_render_mode(Ck *ck, enum RENDER_MODE mode, double wait_timeout) {
+	if (!ck) return;
+	ck->render_mode = mode;
+	ck->wait_timeout = wait_timeout;
+	for (int i = 0; i < ck->window_count; i++)
+		invalidate_window(ck->windows[i]);
 }
\ No newline at end of file
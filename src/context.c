@@ -1,4 +1,5 @@
 #include "../libs/ck.h"
+#include "../libs/ck_internal.h"
 
 Context *create_context() {
 	Context *ctx = (Context *)malloc(sizeof(Context));
@@ -13,6 +14,13 @@ Context *create_context() {
 	ctx->clear_color[1] = 0.0f;
 	ctx->clear_color[2] = 0.0f;
 	ctx->clear_color[3] = 0.0f;
+	ctx->dirty = true;
+	ctx->batch_backgrounds = false;
+	ctx->hit_grid = hit_grid_create();
+	if (!ctx->hit_grid) {
+		free(ctx);
+		return NULL;
+	}
 
 	return ctx;
 }
@@ -25,6 +33,7 @@ void destroy_context(Context *ctx) {
 			}
 			free(ctx->widgets);
 		}
+		hit_grid_destroy(ctx->hit_grid);
 		free(ctx);
 	}
 }
@@ -39,10 +48,16 @@ int add_widget(Context *ctx, Widget *widget) {
 		fprintf(stderr, "Failed to allocate memory for widgets\n");
 		return -1;
 	}
-
 	ctx->widgets = new_widgets;
+	if (hit_grid_insert(ctx->hit_grid, widget) != 0) {
+		fprintf(stderr, "Failed to index widget\n");
+		return -1;
+	}
+
 	ctx->widgets[ctx->widget_count] = widget;
 	ctx->widget_count++;
+	widget->context = ctx;
+	invalidate_context(ctx);
 	return 0;
 }
 
@@ -53,12 +68,26 @@ int remove_widget(Context *ctx, Widget *widget) {
 
 	for (int i = 0; i < ctx->widget_count; i++) {
 		if (ctx->widgets[i] == widget) {
+			hit_grid_remove(ctx->hit_grid, widget);
 			destroy_widget(widget);
 			memmove(&ctx->widgets[i], &ctx->widgets[i + 1],
 				 (ctx->widget_count - i - 1) * sizeof(Widget *));
 			ctx->widget_count--;
+			invalidate_context(ctx);
 			return 0;
 		}
 	}
 	return -1;
-}
\ No newline at end of file
+}
+
+void invalidate_context(Context *ctx) {
+	if (!ctx || ctx->dirty) return;
+	ctx->dirty = true;
+	glfwPostEmptyEvent();
+}
+
+void set_context_batching(Context *ctx, bool enabled) {
+	if (!ctx || ctx->batch_backgrounds == enabled) return;
+	ctx->batch_backgrounds = enabled;
+	invalidate_context(ctx);
+}
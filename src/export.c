@@ -0,0 +1,263 @@
+#include "../libs/ck.h"
+#include "../libs/ck_internal.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../libs/external/stb_image_write.h"
+
+// Jobs travel queued (canvasData::exports) -> reading (PBO + fence, main thread)
+// -> encoding (worker thread) -> done (callback on the main thread).
+
+static void append_job(ExportJob **head, ExportJob **tail, ExportJob *job) {
+	job->next = NULL;
+	if (*tail)
+		(*tail)->next = job;
+	else
+		*head = job;
+	*tail = job;
+}
+
+static void free_job(ExportJob *job) {
+	free(job->path);
+	free(job->pixels);
+	free(job);
+}
+
+static void *export_worker(void *arg) {
+	Exporter *exporter = (Exporter *)arg;
+	for (;;) {
+		pthread_mutex_lock(&exporter->lock);
+		while (!exporter->quit && !exporter->encodeHead)
+			pthread_cond_wait(&exporter->wake, &exporter->lock);
+		if (exporter->quit) {
+			pthread_mutex_unlock(&exporter->lock);
+			break;
+		}
+		ExportJob *job = exporter->encodeHead;
+		exporter->encodeHead = job->next;
+		if (!exporter->encodeHead)
+			exporter->encodeTail = NULL;
+		pthread_mutex_unlock(&exporter->lock);
+
+		// GL hands rows back bottom first, images are stored top first.
+		size_t stride = (size_t)job->width * 4;
+		unsigned char *row = malloc(stride);
+		if (row) {
+			for (int y = 0; y < job->height / 2; y++) {
+				unsigned char *top = job->pixels + y * stride;
+				unsigned char *bottom = job->pixels + (job->height - 1 - y) * stride;
+				memcpy(row, top, stride);
+				memcpy(top, bottom, stride);
+				memcpy(bottom, row, stride);
+			}
+			free(row);
+			job->result = 0;
+		} else {
+			fprintf(stderr, "Failed to allocate memory for export row\n");
+			job->result = -1;
+		}
+
+		if (job->result == 0 && job->path) {
+			if (!stbi_write_png(job->path, job->width, job->height, 4, job->pixels, (int)stride)) {
+				fprintf(stderr, "Failed to write image: %s\n", job->path);
+				job->result = -1;
+			}
+		}
+
+		pthread_mutex_lock(&exporter->lock);
+		append_job(&exporter->doneHead, &exporter->doneTail, job);
+		pthread_mutex_unlock(&exporter->lock);
+		// wakes loopCK so the callback runs without waiting for input
+		glfwPostEmptyEvent();
+	}
+	return NULL;
+}
+
+static Exporter *get_exporter(Ck *ck) {
+	if (ck->exporter)
+		return ck->exporter;
+
+	Exporter *exporter = calloc(1, sizeof(Exporter));
+	if (!exporter) {
+		fprintf(stderr, "Failed to allocate memory for Exporter\n");
+		return NULL;
+	}
+	pthread_mutex_init(&exporter->lock, NULL);
+	pthread_cond_init(&exporter->wake, NULL);
+	if (pthread_create(&exporter->worker, NULL, export_worker, exporter) != 0) {
+		fprintf(stderr, "Failed to start export thread\n");
+		pthread_mutex_destroy(&exporter->lock);
+		pthread_cond_destroy(&exporter->wake);
+		free(exporter);
+		return NULL;
+	}
+	ck->exporter = exporter;
+	return exporter;
+}
+
+static int queue_export(Widget *canvas, const char *path, ExportCallback callback, void *data) {
+	if (!canvas || canvas->render_func != render_canvas) {
+		fprintf(stderr, "Widget is not a canvas\n");
+		return -1;
+	}
+
+	ExportJob *job = calloc(1, sizeof(ExportJob));
+	if (!job) {
+		fprintf(stderr, "Failed to allocate memory for ExportJob\n");
+		return -1;
+	}
+	if (path) {
+		job->path = strdup(path);
+		if (!job->path) {
+			fprintf(stderr, "Failed to allocate memory for export path\n");
+			free(job);
+			return -1;
+		}
+	}
+	job->callback = callback;
+	job->data = data;
+
+	// The readback is issued by the next render of the canvas, after its queued strokes.
+	ExportJob **tail = &((canvasData *)canvas->data)->exports;
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = job;
+	invalidate_widget(canvas);
+	return 0;
+}
+
+int export_canvas_png(Widget *canvas, const char *path, ExportCallback callback, void *data) {
+	if (!path) return -1;
+	return queue_export(canvas, path, callback, data);
+}
+
+int export_canvas_pixels(Widget *canvas, ExportCallback callback, void *data) {
+	if (!callback) return -1;
+	return queue_export(canvas, NULL, callback, data);
+}
+
+// Called with the canvas framebuffer bound for reading.
+void issue_canvas_exports(Ck *ck, canvasData *canvas, int width, int height) {
+	Exporter *exporter = get_exporter(ck);
+	if (!exporter)
+		return;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	while (canvas->exports) {
+		ExportJob *job = canvas->exports;
+		canvas->exports = job->next;
+		job->width = width;
+		job->height = height;
+
+		glGenBuffers(1, &job->PBO);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, job->PBO);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		append_job(&exporter->readHead, &exporter->readTail, job);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void cancel_canvas_exports(canvasData *canvas) {
+	while (canvas->exports) {
+		ExportJob *job = canvas->exports;
+		canvas->exports = job->next;
+		if (job->callback)
+			job->callback(NULL, 0, 0, -1, job->data);
+		free_job(job);
+	}
+}
+
+static void finish_readback(Exporter *exporter, ExportJob *job, bool complete) {
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, job->PBO);
+	size_t size = (size_t)job->width * job->height * 4;
+	void *mapped = complete ? glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT) : NULL;
+	job->pixels = mapped ? malloc(size) : NULL;
+	if (mapped && job->pixels) {
+		memcpy(job->pixels, mapped, size);
+		job->result = 0;
+	} else {
+		fprintf(stderr, "Failed to read back canvas pixels\n");
+		job->result = -1;
+	}
+	if (mapped)
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glDeleteBuffers(1, &job->PBO);
+	glDeleteSync(job->fence);
+	job->PBO = 0;
+	job->fence = NULL;
+
+	pthread_mutex_lock(&exporter->lock);
+	if (job->result == 0) {
+		append_job(&exporter->encodeHead, &exporter->encodeTail, job);
+		pthread_cond_signal(&exporter->wake);
+	} else {
+		append_job(&exporter->doneHead, &exporter->doneTail, job);
+	}
+	pthread_mutex_unlock(&exporter->lock);
+}
+
+void poll_exports(Ck *ck) {
+	Exporter *exporter = ck->exporter;
+	if (!exporter)
+		return;
+
+	// Readbacks complete in submission order, stop at the first one still in flight.
+	while (exporter->readHead) {
+		ExportJob *job = exporter->readHead;
+		GLenum status = glClientWaitSync(job->fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+			break;
+		exporter->readHead = job->next;
+		if (!exporter->readHead)
+			exporter->readTail = NULL;
+		if (status == GL_WAIT_FAILED)
+			fprintf(stderr, "Failed to wait for canvas readback\n");
+		finish_readback(exporter, job, status != GL_WAIT_FAILED);
+	}
+
+	pthread_mutex_lock(&exporter->lock);
+	ExportJob *done = exporter->doneHead;
+	exporter->doneHead = exporter->doneTail = NULL;
+	pthread_mutex_unlock(&exporter->lock);
+
+	while (done) {
+		ExportJob *job = done;
+		done = job->next;
+		if (job->callback) {
+			if (job->result == 0)
+				job->callback(job->pixels, job->width, job->height, 0, job->data);
+			else
+				job->callback(NULL, 0, 0, -1, job->data);
+		}
+		free_job(job);
+	}
+}
+
+bool exports_reading(Ck *ck) {
+	return ck->exporter && ck->exporter->readHead;
+}
+
+// Unfinished exports are dropped without calling back.
+void destroy_exporter(Exporter *exporter) {
+	if (!exporter)
+		return;
+
+	pthread_mutex_lock(&exporter->lock);
+	exporter->quit = true;
+	pthread_cond_signal(&exporter->wake);
+	pthread_mutex_unlock(&exporter->lock);
+	pthread_join(exporter->worker, NULL);
+
+	ExportJob *lists[3] = { exporter->readHead, exporter->encodeHead, exporter->doneHead };
+	for (int i = 0; i < 3; i++) {
+		while (lists[i]) {
+			ExportJob *job = lists[i];
+			lists[i] = job->next;
+			free_job(job);
+		}
+	}
+	pthread_mutex_destroy(&exporter->lock);
+	pthread_cond_destroy(&exporter->wake);
+	free(exporter);
+}
@@ -1,108 +1,337 @@
 #include "../libs/ck.h"
 #include "../libs/ck_internal.h"
 
-void load_font(const char* fontPath, FT_Library* ft, FT_Face* face, int fontSize) {
-	if (FT_Init_FreeType(ft)) {
-		fprintf(stderr, "Could not initialize FreeType library\n");
-		exit(EXIT_FAILURE);
-	}
-
-	if (FT_New_Face(*ft, fontPath, 0, face)) {
+int load_font(const char* fontPath, FT_Library ft, FT_Face* face, int fontSize) {
+	if (FT_New_Face(ft, fontPath, 0, face)) {
 		fprintf(stderr, "Could not load font: %s\n", fontPath);
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 
 	FT_Set_Pixel_Sizes(*face, 0, fontSize);
+	return 0;
 }
 
-HashMap *generate_font_texture(FT_Face face) {
-	HashMap* glyphs = hashmap_create(face->num_glyphs);
-	if (!glyphs) {
-		fprintf(stderr, "Failed to allocate memory for glyphs\n");
-		exit(EXIT_FAILURE);
+static inline GLuint create_atlas_page(void) {
+	GLuint page;
+	glGenTextures(1, &page);
+	glBindTexture(GL_TEXTURE_2D, page);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// New pages start zeroed so the padding between glyphs samples as empty.
+	unsigned char *blank = calloc(FONT_ATLAS_SIZE * FONT_ATLAS_SIZE, 1);
+	if (blank) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, GL_RED, GL_UNSIGNED_BYTE, blank);
+		free(blank);
 	}
+	return page;
+}
 
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	
-	FT_ULong charcode;
-	FT_UInt gindex;
-	
-	charcode = FT_Get_First_Char(face, &gindex);
-	
-	while (gindex != 0) {
-		if (FT_Load_Glyph(face, gindex, FT_LOAD_RENDER)) {
-			fprintf(stderr, "Failed to load glyph for character: %lu (U+%04lX)\n", charcode, charcode);
-			charcode = FT_Get_Next_Char(face, charcode, &gindex);
-			continue;
+static inline int add_atlas_page(Font *font) {
+	GLuint *pages = realloc(font->pages, sizeof(GLuint) * (font->pageCount + 1));
+	if (!pages) {
+		fprintf(stderr, "Failed to allocate memory for font atlas pages\n");
+		return -1;
+	}
+	font->pages = pages;
+	font->pages[font->pageCount] = create_atlas_page();
+	font->pageCount++;
+	atlas_packer_init(&font->packer, FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, FONT_ATLAS_PADDING);
+	return 0;
+}
+
+static inline int pack_glyph(Font *font, Glyph *glyph, const unsigned char *bitmap, int pitch) {
+	// Pages are gone once the last window released them, see release_font_pages.
+	if (font->pageCount == 0 && add_atlas_page(font) != 0)
+		return -1;
+	glyph->page = font->pageCount - 1;
+	glyph->uv[0] = glyph->uv[1] = glyph->uv[2] = glyph->uv[3] = 0.0f;
+	if (glyph->width == 0 || glyph->height == 0)
+		return 0;
+
+	int x, y;
+	if (atlas_packer_insert(&font->packer, glyph->width, glyph->height, &x, &y) != 0) {
+		if (add_atlas_page(font) != 0)
+			return -1;
+		if (atlas_packer_insert(&font->packer, glyph->width, glyph->height, &x, &y) != 0) {
+			fprintf(stderr, "Glyph of %dx%d does not fit in a font atlas page\n", glyph->width, glyph->height);
+			return -1;
 		}
+		glyph->page = font->pageCount - 1;
+	}
 
-		Glyph* glyph = malloc(sizeof(Glyph));
-		if (!glyph) {
-			fprintf(stderr, "Failed to allocate memory for glyph\n");
-			charcode = FT_Get_Next_Char(face, charcode, &gindex);
-			continue;
+	glBindTexture(GL_TEXTURE_2D, font->pages[glyph->page]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, glyph->width, glyph->height, GL_RED, GL_UNSIGNED_BYTE, bitmap);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+	glyph->uv[0] = (float)x / FONT_ATLAS_SIZE;
+	glyph->uv[1] = (float)y / FONT_ATLAS_SIZE;
+	glyph->uv[2] = (float)(x + glyph->width) / FONT_ATLAS_SIZE;
+	glyph->uv[3] = (float)(y + glyph->height) / FONT_ATLAS_SIZE;
+	return 0;
+}
+
+// Stored for codepoints the face has no glyph for, so they are looked up only once.
+Glyph font_missing_glyph;
+
+// Takes ownership of the glyph, freeing it when it cannot be stored.
+static inline int store_glyph(Font *font, uint32_t codepoint, Glyph *glyph) {
+	if (codepoint < GLYPH_TABLE_LIMIT) {
+		Glyph ***page = &font->glyphTable[codepoint >> GLYPH_PAGE_BITS];
+		if (!*page)
+			*page = calloc(GLYPH_PAGE_SIZE, sizeof(Glyph *));
+		if (*page) {
+			(*page)[codepoint & (GLYPH_PAGE_SIZE - 1)] = glyph;
+			return 0;
 		}
-		
-		glyph->width = face->glyph->bitmap.width;
-		glyph->height = face->glyph->bitmap.rows;
-		glyph->bearingX = face->glyph->bitmap_left;
-		glyph->bearingY = face->glyph->bitmap_top;
-		glyph->advance = face->glyph->advance.x >> 6;
-
-		glGenTextures(1, &glyph->textureID);
-		glBindTexture(GL_TEXTURE_2D, glyph->textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_RED,
-			glyph->width,
-			glyph->height,
-			0,
-			GL_RED,
-			GL_UNSIGNED_BYTE,
-			face->glyph->bitmap.buffer
-		);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		
-		hashmap_insert(glyphs, (int)charcode, glyph);
-		
-		charcode = FT_Get_Next_Char(face, charcode, &gindex);
-	}
-	
-	glBindTexture(GL_TEXTURE_2D, 0);
-	return glyphs;
+		// Keep the glyph in the map instead, font_load_glyph finds it there too.
+		fprintf(stderr, "Failed to allocate memory for glyph page\n");
+	}
+	if (hashmap_insert(font->glyphs, (long long int)codepoint, glyph) != 0) {
+		if (glyph != &font_missing_glyph)
+			free(glyph);
+		return -1;
+	}
+	return 0;
+}
+
+// Slow path of font_get_glyph: codepoints outside the BMP and glyphs that are
+// not rasterized yet.
+Glyph *font_load_glyph(Font *font, uint32_t codepoint) {
+	// Also holds BMP glyphs whose table page could not be allocated.
+	Glyph *cached = hashmap_get(font->glyphs, (long long int)codepoint);
+	if (cached)
+		return cached == &font_missing_glyph ? NULL : cached;
+
+	FT_UInt gindex = FT_Get_Char_Index(font->face, codepoint);
+	if (gindex == 0 || FT_Load_Glyph(font->face, gindex, FT_LOAD_RENDER)) {
+		if (gindex != 0)
+			fprintf(stderr, "Failed to load glyph for character: %u (U+%04X)\n", codepoint, codepoint);
+		store_glyph(font, codepoint, &font_missing_glyph);
+		return NULL;
+	}
+
+	Glyph *glyph = malloc(sizeof(Glyph));
+	if (!glyph) {
+		fprintf(stderr, "Failed to allocate memory for glyph\n");
+		return NULL;
+	}
+
+	FT_GlyphSlot slot = font->face->glyph;
+	glyph->width = slot->bitmap.width;
+	glyph->height = slot->bitmap.rows;
+	glyph->bearingX = slot->bitmap_left;
+	glyph->bearingY = slot->bitmap_top;
+	glyph->advance = slot->advance.x >> 6;
+
+	if (pack_glyph(font, glyph, slot->bitmap.buffer, slot->bitmap.pitch) != 0) {
+		free(glyph);
+		store_glyph(font, codepoint, &font_missing_glyph);
+		return NULL;
+	}
+
+	if (store_glyph(font, codepoint, glyph) != 0)
+		return NULL;
+	return glyph;
+}
+
+int preload_font_glyphs(Font *font, uint32_t first, uint32_t last) {
+	if (!font) return -1;
+	int loaded = 0;
+	for (uint32_t codepoint = first; codepoint <= last; codepoint++) {
+		if (font_get_glyph(font, codepoint))
+			loaded++;
+		if (codepoint == UINT32_MAX)
+			break;
+	}
+	return loaded;
 }
 
 Font *get_font(const char* fontPath, int fontSize, FT_Library *ft) {
-	FT_Face face;
 	Font *font = malloc(sizeof(Font));
 	if (!font) {
 		fprintf(stderr, "Failed to allocate memory for Font\n");
 		return NULL;
 	}
 
-	load_font(fontPath, ft, &face, fontSize);
-	HashMap* glyphs = generate_font_texture(face);
-	font->glyphs = glyphs;
-	font->lineHeight = face->height >> 6;
-	font->ascender = face->ascender >> 6;
-	font->descender = face->descender >> 6;
+	font->path = NULL;
+	font->refCount = 1;
+	font->cache = NULL;
+	font->next = NULL;
+	font->pages = NULL;
+	font->pageCount = 0;
+	font->generation = 0;
+	memset(font->glyphTable, 0, sizeof(font->glyphTable));
+
+	if (load_font(fontPath, *ft, &font->face, fontSize) != 0) {
+		free(font);
+		return NULL;
+	}
+
+	// Glyphs are rasterized on first use, see font_load_glyph.
+	font->glyphs = hashmap_create(16);
+	if (!font->glyphs || add_atlas_page(font) != 0) {
+		hashmap_destroy(font->glyphs);
+		FT_Done_Face(font->face);
+		free(font->pages);
+		free(font);
+		return NULL;
+	}
+	font->lineHeight = font->face->height >> 6;
+	font->ascender = font->face->ascender >> 6;
+	font->descender = font->face->descender >> 6;
 	font->fontSize = fontSize;
-	FT_Done_Face(face);
 
 	return font;
 }
 
+static void free_glyphs(Font *font) {
+	for (int i = 0; i < GLYPH_PAGE_COUNT; i++) {
+		Glyph **page = font->glyphTable[i];
+		if (!page)
+			continue;
+		for (int j = 0; j < GLYPH_PAGE_SIZE; j++) {
+			if (page[j] != &font_missing_glyph)
+				free(page[j]);
+		}
+		free(page);
+		font->glyphTable[i] = NULL;
+	}
+	size_t iterator = 0;
+	void *glyph;
+	while (hashmap_next(font->glyphs, &iterator, NULL, &glyph)) {
+		if (glyph != &font_missing_glyph)
+			free(glyph);
+	}
+	hashmap_destroy(font->glyphs);
+	font->glyphs = NULL;
+}
+
 void free_font(Font *font) {
 	if (font) {
-		for (int i = 0; hashmap_get(font->glyphs, i); i++) {
-			glDeleteTextures(1, &(((Glyph *)hashmap_get(font->glyphs, i))->textureID));
-		}
-		free(font->glyphs);
+		free_glyphs(font);
+		// Without pages there may be no GL context left to delete them with.
+		if (font->pageCount > 0)
+			glDeleteTextures(font->pageCount, font->pages);
+		free(font->pages);
+		if (font->face)
+			FT_Done_Face(font->face);
+		free(font->path);
 		free(font);
 	}
 }
 
+static inline long long int font_key(const char *fontPath, int fontSize) {
+	// FNV-1a over the path, folded with the pixel size
+	unsigned long long hash = 14695981039346656037ULL;
+	for (const unsigned char *p = (const unsigned char *)fontPath; *p; p++) {
+		hash ^= *p;
+		hash *= 1099511628211ULL;
+	}
+	hash ^= (unsigned long long)fontSize * 0x9E3779B97F4A7C15ULL;
+	return (long long int)hash;
+}
+
+Font *acquire_font(Ck *ck, const char *fontPath, int fontSize) {
+	if (!ck || !fontPath) return NULL;
+
+	long long int key = font_key(fontPath, fontSize);
+	Font *head = hashmap_get(ck->fonts, key);
+	for (Font *font = head; font; font = font->next) {
+		if (font->fontSize == fontSize && strcmp(font->path, fontPath) == 0) {
+			font->refCount++;
+			return font;
+		}
+	}
+
+	Font *font = get_font(fontPath, fontSize, &ck->ft);
+	if (!font)
+		return NULL;
+	font->path = malloc(strlen(fontPath) + 1);
+	if (!font->path) {
+		fprintf(stderr, "Failed to allocate memory for font path\n");
+		free_font(font);
+		return NULL;
+	}
+	strcpy(font->path, fontPath);
+	font->refCount = 1;
+	font->cache = ck->fonts;
+	font->next = head;
+
+	if (head)
+		hashmap_replace(ck->fonts, key, font);
+	else if (hashmap_insert(ck->fonts, key, font) != 0) {
+		free_font(font);
+		return NULL;
+	}
+	return font;
+}
+
+void release_font(Font *font) {
+	if (!font) return;
+	if (--font->refCount > 0) return;
+
+	if (font->cache) {
+		long long int key = font_key(font->path, font->fontSize);
+		Font *head = hashmap_get(font->cache, key);
+		if (head == font) {
+			if (font->next)
+				hashmap_replace(font->cache, key, font->next);
+			else
+				hashmap_remove(font->cache, key);
+		} else {
+			for (Font *prev = head; prev; prev = prev->next) {
+				if (prev->next == font) {
+					prev->next = font->next;
+					break;
+				}
+			}
+		}
+	}
+	free_font(font);
+}
+
+void release_font_pages(HashMap *cache) {
+	if (!cache) return;
+	size_t iterator = 0;
+	void *value;
+	while (hashmap_next(cache, &iterator, NULL, &value)) {
+		for (Font *font = value; font; font = font->next) {
+			// Glyphs point into the pages, they are rasterized again on next use.
+			free_glyphs(font);
+			font->glyphs = hashmap_create(16);
+			glDeleteTextures(font->pageCount, font->pages);
+			font->pageCount = 0;
+			font->generation++;
+		}
+	}
+}
+
+void destroy_font_cache(HashMap *cache) {
+	if (!cache) return;
+	size_t iterator = 0;
+	void *value;
+	while (hashmap_next(cache, &iterator, NULL, &value)) {
+		Font *font = value;
+		while (font) {
+			Font *next = font->next;
+			// Fonts still held by widgets are freed by their last release_font,
+			// only the face has to go now since it belongs to the FreeType library.
+			if (font->refCount > 0) {
+				FT_Done_Face(font->face);
+				font->face = NULL;
+				font->cache = NULL;
+				font->next = NULL;
+			} else {
+				free_font(font);
+			}
+			font = next;
+		}
+	}
+	hashmap_destroy(cache);
+}
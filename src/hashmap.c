@@ -1,132 +1,172 @@
 #include "../libs/ck.h"
 #include "../libs/ck_internal.h"
 
+#define HASHMAP_MIN_SIZE 8
+
+// The table grows past 3/4 load and shrinks below 1/8, never under its initial size.
+#define HASHMAP_GROW_LOAD(size) ((size) / 4 * 3)
+#define HASHMAP_SHRINK_LOAD(size) ((size) / 8)
+
+static inline size_t hashmap_capacity_for(size_t count) {
+	size_t size = HASHMAP_MIN_SIZE;
+	while (HASHMAP_GROW_LOAD(size) < count)
+		size <<= 1;
+	return size;
+}
+
+// splitmix64 finalizer, spreads small integers and aligned pointers over every bit
+static inline size_t hash_key(long long int key) {
+	unsigned long long x = (unsigned long long)key;
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return (size_t)x;
+}
+
 HashMap *hashmap_create(size_t size) {
 	HashMap *map = calloc(1, sizeof(HashMap));
 	if (!map) {
 		fprintf(stderr, "Failed to allocate memory for HashMap\n");
 		return NULL;
 	}
-	map->size = size;
+	map->size = hashmap_capacity_for(size);
+	map->minSize = map->size;
 	map->count = 0;
-	map->buckets = calloc(size, sizeof(Bucket *));
-	if (!map->buckets) {
-		fprintf(stderr, "Failed to allocate memory for HashMap buckets\n");
+	map->entries = calloc(map->size, sizeof(HashMapEntry));
+	if (!map->entries) {
+		fprintf(stderr, "Failed to allocate memory for HashMap entries\n");
 		free(map);
 		return NULL;
 	}
 	return map;
 }
 
-static inline size_t sdbm(const char *str) {
-	size_t hash = 0;
-	int c;
-	while ((c = *str++)) {
-		hash = c + (hash << 6) + (hash << 16) - hash;
+// Returns the slot holding key, or the empty slot where it would be inserted.
+static inline size_t hashmap_find(const HashMap *map, long long int key) {
+	size_t mask = map->size - 1;
+	size_t index = hash_key(key) & mask;
+	while (map->entries[index].used && map->entries[index].key != key)
+		index = (index + 1) & mask;
+	return index;
+}
+
+static int hashmap_rehash(HashMap *map, size_t size) {
+	HashMapEntry *entries = calloc(size, sizeof(HashMapEntry));
+	if (!entries) {
+		fprintf(stderr, "Failed to allocate memory for HashMap entries\n");
+		return -1;
+	}
+	HashMapEntry *old = map->entries;
+	size_t old_size = map->size;
+	map->entries = entries;
+	map->size = size;
+	for (size_t i = 0; i < old_size; i++) {
+		if (old[i].used)
+			map->entries[hashmap_find(map, old[i].key)] = old[i];
 	}
-	return hash;
+	free(old);
+	return 0;
 }
 
 int hashmap_insert(HashMap *map, long long int key, void *value) {
-	if (!map || !map->buckets) {
+	if (!map || !map->entries) {
 		fprintf(stderr, "HashMap is not initialized\n");
 		return -1;
 	}
-	size_t index = sdbm((const char *)&key) % map->size;
-	Bucket *bucket = calloc(1, sizeof(Bucket));
-	if (!bucket) {
-		fprintf(stderr, "Failed to allocate memory for HashMap bucket\n");
+	if (map->count + 1 > HASHMAP_GROW_LOAD(map->size) && hashmap_rehash(map, map->size << 1) != 0)
 		return -1;
+
+	size_t index = hashmap_find(map, key);
+	HashMapEntry *entry = &map->entries[index];
+	if (!entry->used) {
+		entry->used = true;
+		entry->key = key;
+		map->count++;
 	}
-	bucket->key = key;
-	bucket->value = value;
-	bucket->next = map->buckets[index];
-	map->buckets[index] = bucket;
-	map->count++;
+	entry->value = value;
 	return 0;
 }
 
 void *hashmap_get(HashMap *map, long long int key) {
-	if (!map || !map->buckets) {
+	if (!map || !map->entries) {
 		fprintf(stderr, "HashMap is not initialized\n");
 		return NULL;
 	}
-	size_t index = sdbm((const char *)&key) % map->size;
-	Bucket *bucket = map->buckets[index];
-	while (bucket) {
-		if (bucket->key == key) {
-			return bucket->value;
-		}
-		bucket = bucket->next;
-	}
-	return NULL;
+	HashMapEntry *entry = &map->entries[hashmap_find(map, key)];
+	return entry->used ? entry->value : NULL;
 }
 
 int hashmap_remove(HashMap *map, long long int key) {
-	if (!map || !map->buckets) {
+	if (!map || !map->entries) {
 		fprintf(stderr, "HashMap is not initialized\n");
 		return -1;
 	}
-	size_t index = sdbm((const char *)&key) % map->size;
-	Bucket *bucket = map->buckets[index];
-	Bucket *prev = NULL;
-	while (bucket) {
-		if (bucket->key == key) {
-			if (prev) {
-				prev->next = bucket->next;
-			} else {
-				map->buckets[index] = bucket->next;
-			}
-			free(bucket);
-			map->count--;
-			return 0;
+	size_t mask = map->size - 1;
+	size_t hole = hashmap_find(map, key);
+	if (!map->entries[hole].used)
+		return -1;
+
+	// Backward-shift deletion: pull later members of the probe run into the hole
+	// so lookups never need tombstones.
+	size_t index = hole;
+	for (;;) {
+		index = (index + 1) & mask;
+		if (!map->entries[index].used)
+			break;
+		size_t home = hash_key(map->entries[index].key) & mask;
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			map->entries[hole] = map->entries[index];
+			hole = index;
 		}
-		prev = bucket;
-		bucket = bucket->next;
 	}
-	return -1;
+	map->entries[hole].used = false;
+	map->entries[hole].value = NULL;
+	map->count--;
+
+	if (map->size > map->minSize && map->count < HASHMAP_SHRINK_LOAD(map->size))
+		hashmap_rehash(map, map->size >> 1);
+	return 0;
 }
 
 void *hashmap_replace(HashMap *map, long long int key, void *value) {
-	if (!map || !map->buckets) {
+	if (!map || !map->entries) {
 		fprintf(stderr, "HashMap is not initialized\n");
 		return NULL;
 	}
-	void *old_value = hashmap_get(map, key);
-	size_t index = sdbm((const char *)&key) % map->size;
-	Bucket *b = map->buckets[index];
-	while (b->key != key) b = b->next;
-	b->value = value;
+	HashMapEntry *entry = &map->entries[hashmap_find(map, key)];
+	if (!entry->used)
+		return NULL;
+	void *old_value = entry->value;
+	entry->value = value;
 	return old_value;
-
 }
 
 void hashmap_destroy(HashMap *map) {
 	if (!map) return;
-	for (size_t i = 0; i < map->size; i++) {
-		Bucket *bucket = map->buckets[i];
-		while (bucket) {
-			Bucket *next = bucket->next;
-			free(bucket);
-			bucket = next;
-		}
-	}
-	free(map->buckets);
+	free(map->entries);
 	free(map);
 }
 
 HashMap *hashmap_resize(HashMap *map, int size) {
-	HashMap *new = hashmap_create(size);
-	for (size_t i = 0; i < map->size; i++)
-	{
-		Bucket *c = map->buckets[i];
-		while (c)
-		{
-			Bucket *temp = c;
-			hashmap_insert(new, c->key, c->value);
-			c = c->next;
-			free(temp);
+	if (!map || !map->entries || size < 0) return NULL;
+	size_t capacity = hashmap_capacity_for((size_t)size > map->count ? (size_t)size : map->count);
+	if (capacity != map->size && hashmap_rehash(map, capacity) != 0)
+		return NULL;
+	map->minSize = capacity;
+	return map;
+}
+
+bool hashmap_next(HashMap *map, size_t *iterator, long long int *key, void **value) {
+	if (!map || !map->entries || !iterator) return false;
+	while (*iterator < map->size) {
+		HashMapEntry *entry = &map->entries[(*iterator)++];
+		if (entry->used) {
+			if (key) *key = entry->key;
+			if (value) *value = entry->value;
+			return true;
 		}
 	}
-	free(map);
-}
\ No newline at end of file
+	return false;
+}
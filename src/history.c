@@ -0,0 +1,260 @@
+#include "../libs/ck.h"
+#include "../libs/ck_internal.h"
+
+// Patches are stored as runs of identical RGBA pixels: a 32 bit count followed by the pixel.
+// Untouched or blank areas of a stroke's bounding box collapse to a few runs.
+
+static unsigned char *rle_encode(const uint32_t *pixels, size_t count, size_t *size) {
+	size_t capacity = 256, used = 0;
+	unsigned char *data = malloc(capacity);
+	if (!data) {
+		fprintf(stderr, "Failed to allocate memory for history patch\n");
+		return NULL;
+	}
+	size_t i = 0;
+	while (i < count) {
+		uint32_t pixel = pixels[i];
+		uint32_t run = 1;
+		while (i + run < count && pixels[i + run] == pixel && run < UINT32_MAX)
+			run++;
+		if (used + 2 * sizeof(uint32_t) > capacity) {
+			capacity *= 2;
+			unsigned char *grown = realloc(data, capacity);
+			if (!grown) {
+				fprintf(stderr, "Failed to allocate memory for history patch\n");
+				free(data);
+				return NULL;
+			}
+			data = grown;
+		}
+		memcpy(data + used, &run, sizeof(uint32_t));
+		memcpy(data + used + sizeof(uint32_t), &pixel, sizeof(uint32_t));
+		used += 2 * sizeof(uint32_t);
+		i += run;
+	}
+	// Give back the slack, patches can stay in the history for a long time.
+	unsigned char *shrunk = realloc(data, used ? used : 1);
+	*size = used;
+	return shrunk ? shrunk : data;
+}
+
+static void rle_decode(const unsigned char *data, size_t size, uint32_t *pixels, size_t count) {
+	size_t written = 0;
+	for (size_t offset = 0; offset + 2 * sizeof(uint32_t) <= size && written < count; offset += 2 * sizeof(uint32_t)) {
+		uint32_t run, pixel;
+		memcpy(&run, data + offset, sizeof(uint32_t));
+		memcpy(&pixel, data + offset + sizeof(uint32_t), sizeof(uint32_t));
+		for (uint32_t i = 0; i < run && written < count; i++)
+			pixels[written++] = pixel;
+	}
+}
+
+// Reads the patch's region of the framebuffer and returns it encoded.
+static unsigned char *capture_region(const HistoryPatch *patch, GLuint FBO, size_t *size) {
+	size_t count = (size_t)patch->width * patch->height;
+	uint32_t *pixels = malloc(count * sizeof(uint32_t));
+	if (!pixels) {
+		fprintf(stderr, "Failed to allocate memory for history readback\n");
+		return NULL;
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(patch->x, patch->y, patch->width, patch->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	unsigned char *data = rle_encode(pixels, count, size);
+	free(pixels);
+	return data;
+}
+
+static void free_step(HistoryStep *step) {
+	for (int i = 0; i < step->count; i++)
+		free(step->patches[i].data);
+	free(step->patches);
+}
+
+// Drops the oldest undo steps first, then the redo steps from the newest down, so the
+// kept steps stay one contiguous run and the step at current is the last to go.
+static void trim_history(CanvasHistory *history) {
+	int dropped = 0;
+	while (dropped < history->current && history->bytes > history->budget) {
+		history->bytes -= history->steps[dropped].bytes;
+		free_step(&history->steps[dropped]);
+		dropped++;
+	}
+	if (dropped > 0) {
+		memmove(history->steps, history->steps + dropped, sizeof(HistoryStep) * (history->count - dropped));
+		history->count -= dropped;
+		history->current -= dropped;
+	}
+	while (history->count > history->current && history->bytes > history->budget) {
+		HistoryStep *redo = &history->steps[--history->count];
+		history->bytes -= redo->bytes;
+		free_step(redo);
+	}
+}
+
+static void push_step(CanvasHistory *history, HistoryStep step) {
+	// A new change makes the undone steps unreachable.
+	while (history->count > history->current) {
+		HistoryStep *redo = &history->steps[--history->count];
+		history->bytes -= redo->bytes;
+		free_step(redo);
+	}
+	if (history->count == history->capacity) {
+		int capacity = history->capacity ? history->capacity * 2 : 16;
+		HistoryStep *steps = realloc(history->steps, sizeof(HistoryStep) * capacity);
+		if (!steps) {
+			fprintf(stderr, "Failed to allocate memory for canvas history\n");
+			free_step(&step);
+			return;
+		}
+		history->steps = steps;
+		history->capacity = capacity;
+	}
+	history->steps[history->count++] = step;
+	history->current = history->count;
+	history->bytes += step.bytes;
+	trim_history(history);
+}
+
+static int add_patch(HistoryStep *step, HistoryPatch patch, GLuint FBO) {
+	patch.data = capture_region(&patch, FBO, &patch.size);
+	if (!patch.data)
+		return -1;
+	HistoryPatch *patches = realloc(step->patches, sizeof(HistoryPatch) * (step->count + 1));
+	if (!patches) {
+		fprintf(stderr, "Failed to allocate memory for history patch\n");
+		free(patch.data);
+		return -1;
+	}
+	step->patches = patches;
+	step->patches[step->count++] = patch;
+	step->bytes += patch.size;
+	return 0;
+}
+
+// Saves the level 0 tiles about to be drawn on, see rasterize_canvas_tiles.
+void record_canvas_tiles(canvasData *canvas) {
+	HistoryStep step = {0};
+	for (int i = 0; i < canvas->touchedCount; i++) {
+		CanvasTile *tile = canvas->touched[i];
+		HistoryPatch patch = {
+			.tileX = tile->x,
+			.tileY = tile->y,
+			.x = 0,
+			.y = 0,
+			.width = CANVAS_TILE_SIZE,
+			.height = CANVAS_TILE_SIZE
+		};
+		if (add_patch(&step, patch, tile->FBO) != 0) {
+			free_step(&step);
+			return;
+		}
+	}
+	if (step.count > 0)
+		push_step(&canvas->history, step);
+}
+
+// Saves the bounding rectangle of the commands about to be drawn on a plain canvas.
+void record_canvas_rect(canvasData *canvas, const CommandBuffer *buffer, Size size) {
+	float rect[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+	for (int i = 0; i < buffer->count; i++) {
+		float bounds[4];
+		if (!canvas_command_bounds(buffer, &buffer->commands[i], bounds))
+			continue;
+		rect[0] = fminf(rect[0], bounds[0]);
+		rect[1] = fminf(rect[1], bounds[1]);
+		rect[2] = fmaxf(rect[2], bounds[2]);
+		rect[3] = fmaxf(rect[3], bounds[3]);
+	}
+	int x0 = (int)fmaxf(floorf(rect[0]), 0.0f);
+	int y0 = (int)fmaxf(floorf(rect[1]), 0.0f);
+	int x1 = (int)fminf(ceilf(rect[2]), (float)size.width);
+	int y1 = (int)fminf(ceilf(rect[3]), (float)size.height);
+	if (x1 <= x0 || y1 <= y0)
+		return;
+
+	HistoryStep step = {0};
+	HistoryPatch patch = {
+		.tileX = -1,
+		.tileY = -1,
+		.x = x0,
+		.y = y0,
+		.width = x1 - x0,
+		.height = y1 - y0
+	};
+	if (add_patch(&step, patch, canvas->FBO) != 0)
+		return;
+	push_step(&canvas->history, step);
+}
+
+// Undo and redo are the same operation: every patch of the step trades places with
+// the pixels it covers, so the step afterwards holds what it replaced.
+int swap_canvas_history(canvasData *canvas, bool undo) {
+	CanvasHistory *history = &canvas->history;
+	if (undo ? history->current == 0 : history->current == history->count)
+		return -1;
+	HistoryStep *step = &history->steps[undo ? history->current - 1 : history->current];
+
+	history->bytes -= step->bytes;
+	step->bytes = 0;
+	for (int i = 0; i < step->count; i++) {
+		HistoryPatch *patch = &step->patches[i];
+		GLuint FBO = canvas->FBO, texture = canvas->bitmap;
+		CanvasTile *tile = NULL;
+		if (canvas->tiles) {
+			tile = hashmap_get(canvas->tiles, tile_key(0, patch->tileX, patch->tileY));
+			if (!tile)
+				continue;
+			FBO = tile->FBO;
+			texture = tile->texture;
+		}
+
+		size_t size;
+		unsigned char *current = capture_region(patch, FBO, &size);
+		size_t count = (size_t)patch->width * patch->height;
+		uint32_t *pixels = malloc(count * sizeof(uint32_t));
+		if (!current || !pixels) {
+			fprintf(stderr, "Failed to allocate memory for history swap\n");
+			free(current);
+			free(pixels);
+			step->bytes += patch->size;
+			continue;
+		}
+		rle_decode(patch->data, patch->size, pixels, count);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, patch->x, patch->y, patch->width, patch->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		free(pixels);
+
+		free(patch->data);
+		patch->data = current;
+		patch->size = size;
+		step->bytes += size;
+		if (tile)
+			touch_tile(canvas, tile);
+	}
+	history->bytes += step->bytes;
+	history->current += undo ? -1 : 1;
+	// The swapped pixels can encode larger than the ones they replaced.
+	trim_history(history);
+	return 0;
+}
+
+void destroy_canvas_history(CanvasHistory *history) {
+	for (int i = 0; i < history->count; i++)
+		free_step(&history->steps[i]);
+	free(history->steps);
+	history->steps = NULL;
+	history->count = 0;
+	history->capacity = 0;
+	history->current = 0;
+	history->bytes = 0;
+}
+
+void set_canvas_history_budget(CanvasHistory *history, size_t budget) {
+	history->budget = budget;
+	if (budget == 0)
+		destroy_canvas_history(history);
+	else
+		trim_history(history);
+}
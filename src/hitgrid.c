@@ -0,0 +1,204 @@
+#include "../libs/ck.h"
+#include "../libs/ck_internal.h"
+
+static inline int hit_cell(float coordinate) {
+	return (int)floorf(coordinate / HIT_GRID_CELL_SIZE);
+}
+
+// Cells are inclusive on both ends, like the hit test itself.
+static inline void hit_grid_range(const Widget *widget, int range[4]) {
+	range[0] = hit_cell(widget->position.x);
+	range[1] = hit_cell(widget->position.y);
+	range[2] = hit_cell(widget->position.x + widget->size.width);
+	range[3] = hit_cell(widget->position.y + widget->size.height);
+}
+
+static int reserve_widgets(Widget ***widgets, int *capacity, int count) {
+	if (count <= *capacity)
+		return 0;
+	int grown = *capacity ? *capacity : 4;
+	while (grown < count)
+		grown *= 2;
+	Widget **resized = realloc(*widgets, sizeof(Widget *) * grown);
+	if (!resized) {
+		fprintf(stderr, "Failed to allocate memory for hit grid widgets\n");
+		return -1;
+	}
+	*widgets = resized;
+	*capacity = grown;
+	return 0;
+}
+
+static inline void remove_widget_from(Widget **widgets, int *count, Widget *widget) {
+	for (int i = 0; i < *count; i++) {
+		if (widgets[i] == widget) {
+			widgets[i] = widgets[--*count];
+			return;
+		}
+	}
+}
+
+HitGrid *hit_grid_create() {
+	HitGrid *grid = calloc(1, sizeof(HitGrid));
+	if (!grid) {
+		fprintf(stderr, "Failed to allocate memory for HitGrid\n");
+		return NULL;
+	}
+	grid->cells = hashmap_create(64);
+	if (!grid->cells) {
+		free(grid);
+		return NULL;
+	}
+	return grid;
+}
+
+void hit_grid_destroy(HitGrid *grid) {
+	if (!grid) return;
+	size_t iterator = 0;
+	HitCell *cell;
+	while (hashmap_next(grid->cells, &iterator, NULL, (void **)&cell)) {
+		free(cell->widgets);
+		free(cell);
+	}
+	hashmap_destroy(grid->cells);
+	free(grid->large);
+	free(grid->active);
+	free(grid->candidates);
+	free(grid);
+}
+
+static int hit_cell_add(HitGrid *grid, int x, int y, Widget *widget) {
+	HitCell *cell = hashmap_get(grid->cells, tile_key(0, x, y));
+	if (!cell) {
+		cell = calloc(1, sizeof(HitCell));
+		if (!cell) {
+			fprintf(stderr, "Failed to allocate memory for hit grid cell\n");
+			return -1;
+		}
+		if (hashmap_insert(grid->cells, tile_key(0, x, y), cell) != 0) {
+			free(cell);
+			return -1;
+		}
+	}
+	if (reserve_widgets(&cell->widgets, &cell->capacity, cell->count + 1) != 0)
+		return -1;
+	cell->widgets[cell->count++] = widget;
+	return 0;
+}
+
+static void hit_cell_remove(HitGrid *grid, int x, int y, Widget *widget) {
+	HitCell *cell = hashmap_get(grid->cells, tile_key(0, x, y));
+	if (!cell) return;
+	for (int i = 0; i < cell->count; i++) {
+		if (cell->widgets[i] == widget) {
+			// Overlapping widgets keep a stable order, so are signalled in the same order every time.
+			memmove(&cell->widgets[i], &cell->widgets[i + 1], (cell->count - i - 1) * sizeof(Widget *));
+			cell->count--;
+			break;
+		}
+	}
+	if (cell->count == 0) {
+		hashmap_remove(grid->cells, tile_key(0, x, y));
+		free(cell->widgets);
+		free(cell);
+	}
+}
+
+static void hit_grid_unlink(HitGrid *grid, Widget *widget) {
+	for (int y = widget->grid_cells[1]; y <= widget->grid_cells[3]; y++)
+		for (int x = widget->grid_cells[0]; x <= widget->grid_cells[2]; x++)
+			hit_cell_remove(grid, x, y, widget);
+	remove_widget_from(grid->large, &grid->largeCount, widget);
+	widget->grid_cells[0] = widget->grid_cells[1] = 0;
+	widget->grid_cells[2] = widget->grid_cells[3] = -1;
+}
+
+int hit_grid_insert(HitGrid *grid, Widget *widget) {
+	if (!grid || !widget) return -1;
+	int range[4];
+	hit_grid_range(widget, range);
+	grid->version++;
+
+	// Canvases sized to a whole drawing surface would otherwise fill thousands of cells.
+	long long cells = (long long)(range[2] - range[0] + 1) * (range[3] - range[1] + 1);
+	if (cells > HIT_GRID_MAX_CELLS) {
+		if (reserve_widgets(&grid->large, &grid->largeCapacity, grid->largeCount + 1) != 0)
+			return -1;
+		grid->large[grid->largeCount++] = widget;
+		return 0;
+	}
+
+	memcpy(widget->grid_cells, range, sizeof(range));
+	for (int y = range[1]; y <= range[3]; y++) {
+		for (int x = range[0]; x <= range[2]; x++) {
+			if (hit_cell_add(grid, x, y, widget) != 0) {
+				hit_grid_unlink(grid, widget);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+void hit_grid_remove(HitGrid *grid, Widget *widget) {
+	if (!grid || !widget) return;
+	hit_grid_unlink(grid, widget);
+	remove_widget_from(grid->active, &grid->activeCount, widget);
+	grid->version++;
+}
+
+int hit_grid_update(HitGrid *grid, Widget *widget) {
+	if (!grid || !widget) return -1;
+	// The widget may have moved under a still cursor even when it kept its cells.
+	grid->version++;
+	int range[4];
+	hit_grid_range(widget, range);
+	if (memcmp(range, widget->grid_cells, sizeof(range)) == 0)
+		return 0;
+	hit_grid_unlink(grid, widget);
+	return hit_grid_insert(grid, widget);
+}
+
+// Copies the widgets of the cell under the position and the large widgets, the
+// copy stays valid while handlers move or remove widgets, until the next query.
+Widget **hit_grid_query(HitGrid *grid, Position position, int *count) {
+	*count = 0;
+	if (!grid) return NULL;
+	HitCell *cell = hashmap_get(grid->cells, tile_key(0, hit_cell(position.x), hit_cell(position.y)));
+	int cellCount = cell ? cell->count : 0;
+	if (reserve_widgets(&grid->candidates, &grid->candidateCapacity, cellCount + grid->largeCount) != 0)
+		return NULL;
+	if (cellCount > 0)
+		memcpy(grid->candidates, cell->widgets, sizeof(Widget *) * cellCount);
+	if (grid->largeCount > 0)
+		memcpy(grid->candidates + cellCount, grid->large, sizeof(Widget *) * grid->largeCount);
+	*count = cellCount + grid->largeCount;
+	return grid->candidates;
+}
+
+int hit_grid_activate(HitGrid *grid, Widget *widget) {
+	if (reserve_widgets(&grid->active, &grid->activeCapacity, grid->activeCount + 1) != 0)
+		return -1;
+	grid->active[grid->activeCount++] = widget;
+	return 0;
+}
+
+// Copy of the active widgets, in the same buffer as hit_grid_query.
+Widget **hit_grid_hovered(HitGrid *grid, int *count) {
+	*count = 0;
+	if (reserve_widgets(&grid->candidates, &grid->candidateCapacity, grid->activeCount) != 0)
+		return NULL;
+	if (grid->activeCount > 0)
+		memcpy(grid->candidates, grid->active, sizeof(Widget *) * grid->activeCount);
+	*count = grid->activeCount;
+	return grid->candidates;
+}
+
+// Compares pointers only, so it is safe on widgets a handler already freed:
+// removal takes them off the active list first.
+bool hit_grid_is_active(const HitGrid *grid, const Widget *widget) {
+	for (int i = 0; i < grid->activeCount; i++)
+		if (grid->active[i] == widget)
+			return true;
+	return false;
+}
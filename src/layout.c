@@ -0,0 +1,190 @@
+#include "../libs/ck.h"
+#include "../libs/ck_internal.h"
+
+static inline int layout_reserve(TextLayout *layout, int count) {
+	if (layout->count + count <= layout->capacity)
+		return 0;
+	int capacity = layout->capacity ? layout->capacity : 64;
+	while (capacity < layout->count + count)
+		capacity *= 2;
+	LayoutGlyph *grown = realloc(layout->glyphs, sizeof(LayoutGlyph) * capacity);
+	if (!grown) {
+		fprintf(stderr, "Failed to allocate memory for text layout\n");
+		return -1;
+	}
+	layout->glyphs = grown;
+	layout->capacity = capacity;
+	return 0;
+}
+
+// Places the glyphs of [start, end) on one baseline, relative to the widget origin.
+static inline void layout_add_segment(TextLayout *layout, Font *font, const char *start, const char *end, float x, float y) {
+	while (start < end) {
+		uint32_t codepoint;
+		int bytes = utf8_decode(start, &codepoint);
+		if (bytes == 0) {
+			start++;
+			continue;
+		}
+		start += bytes;
+
+		Glyph *glyph = font_get_glyph(font, codepoint);
+		if (!glyph)
+			continue;
+
+		if (glyph->width > 0 && glyph->height > 0) {
+			if (layout_reserve(layout, 1) != 0)
+				return;
+			LayoutGlyph *placed = &layout->glyphs[layout->count++];
+			placed->x = x + glyph->bearingX;
+			placed->y = y - (glyph->height - glyph->bearingY + font->descender);
+			placed->width = glyph->width;
+			placed->height = glyph->height;
+			memcpy(placed->uv, glyph->uv, sizeof(placed->uv));
+			placed->texture = font->pages[glyph->page];
+		}
+		x += glyph->advance;
+	}
+}
+
+// FNV-1a, the length comes from the same pass.
+static inline unsigned long long text_hash(const char *text, size_t *length) {
+	unsigned long long hash = 14695981039346656037ULL;
+	const unsigned char *p = (const unsigned char *)text;
+	if (p) {
+		for (; *p; p++) {
+			hash ^= *p;
+			hash *= 1099511628211ULL;
+		}
+	}
+	*length = p ? (size_t)(p - (const unsigned char *)text) : 0;
+	return hash;
+}
+
+static void build_text_layout(TextLayout *layout, Widget *widget, size_t length, unsigned long long hash) {
+	Font *font = widget->font;
+	const char *text = widget->text;
+
+	layout->count = 0;
+	layout->text = text;
+	layout->textLength = length;
+	layout->textHash = hash;
+	layout->font = font;
+	layout->fontGeneration = font ? font->generation : 0;
+	layout->size = widget->size;
+	layout->alignment = widget->text_alignment;
+	layout->valid = true;
+	if (!text || !font)
+		return;
+
+	int total_lines = line_count(text, widget->size.width, font);
+	int line_index = 0;
+
+	const char *text_ptr = text;
+	while (*text_ptr) {
+		const char *line_end = text_ptr;
+		while (*line_end && *line_end != '\n') {
+			uint32_t codepoint;
+			int bytes = utf8_decode(line_end, &codepoint);
+			line_end += (bytes > 0) ? bytes : 1;
+		}
+
+		const char *line_ptr = text_ptr;
+		while (line_ptr < line_end) {
+			int segment_width = 0;
+			const char *char_start = line_ptr;
+			const char *char_end = line_ptr;
+
+			while (char_end < line_end) {
+				uint32_t codepoint;
+				int bytes = utf8_decode(char_end, &codepoint);
+				if (bytes == 0) {
+					char_end++;
+					continue;
+				}
+
+				Glyph *glyph = font_get_glyph(font, codepoint);
+				if (!glyph) {
+					char_end += bytes;
+					continue;
+				}
+
+				if (segment_width + glyph->advance > widget->size.width)
+					break;
+
+				segment_width += glyph->advance;
+				char_end += bytes;
+			}
+
+			if (char_end > char_start) {
+				int offset_x = alignment_offset_x(widget->text_alignment, widget->size, segment_width);
+				int offset_y = get_alignment_offset_y(widget->text_alignment, widget->size, font->ascender, total_lines, line_index);
+				layout_add_segment(layout, font, char_start, char_end, offset_x, offset_y);
+			}
+			line_index++;
+			line_ptr = char_end;
+
+			// A glyph wider than the widget is skipped rather than looping forever.
+			if (char_end == char_start) {
+				uint32_t codepoint;
+				int bytes = utf8_decode(line_ptr, &codepoint);
+				line_ptr += (bytes > 0) ? bytes : 1;
+			}
+		}
+
+		text_ptr = line_end;
+		if (*text_ptr == '\n')
+			text_ptr++;
+	}
+}
+
+TextLayout *widget_text_layout(Widget *widget) {
+	if (!widget->layout) {
+		widget->layout = calloc(1, sizeof(TextLayout));
+		if (!widget->layout) {
+			fprintf(stderr, "Failed to allocate memory for text layout\n");
+			return NULL;
+		}
+	}
+
+	TextLayout *layout = widget->layout;
+	size_t length;
+	unsigned long long hash = text_hash(widget->text, &length);
+	if (!layout->valid || layout->text != widget->text || layout->textLength != length ||
+		layout->textHash != hash || layout->font != widget->font ||
+		(widget->font && layout->fontGeneration != widget->font->generation) ||
+		layout->size.width != widget->size.width || layout->size.height != widget->size.height ||
+		layout->alignment != widget->text_alignment)
+		build_text_layout(layout, widget, length, hash);
+	return layout;
+}
+
+void invalidate_text_layout(Widget *widget) {
+	if (widget && widget->layout)
+		widget->layout->valid = false;
+}
+
+void destroy_text_layout(TextLayout *layout) {
+	if (!layout) return;
+	free(layout->glyphs);
+	free(layout);
+}
+
+int set_widget_text(Widget *widget, const char *text) {
+	if (!widget) return -1;
+
+	char *copy = NULL;
+	if (text) {
+		copy = malloc(strlen(text) + 1);
+		if (!copy) {
+			fprintf(stderr, "Failed to allocate memory for widget text\n");
+			return -1;
+		}
+		strcpy(copy, text);
+	}
+	free(widget->text);
+	widget->text = copy;
+	invalidate_text_layout(widget);
+	invalidate_widget(widget);
+	return 0;
+}
@@ -2,343 +2,125 @@
 #include "../libs/ck.h"
 #include "../libs/ck_internal.h"
 
-static inline void render_text(textRenderParameters params) {
-	GLuint VAO, VBO;
-
-	glGenVertexArrays(1, &VAO);
-	glBindVertexArray(VAO);
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
-	glUseProgram(params.shaderProgram);
-
-	int width, height;
-	glfwGetFramebufferSize(glfwGetCurrentContext(), &width, &height);
-	float screenSize[] = { (float)width, (float)height };
-	glUniform2fv(glGetUniformLocation(params.shaderProgram, "screenSize"), 1, screenSize);
-	glUniform3fv(glGetUniformLocation(params.shaderProgram, "textColor"), 1, params.color);
-
-	glActiveTexture(GL_TEXTURE0);
+static inline void render_texture(Window *win, textureRenderParameters params) {
+	float xpos = params.x;
+	float ypos = params.y;
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	float w = params.width;
+	float h = params.height;
 
-	int lineCount = 0;
-	const char* p = params.text;
-	uint32_t codepoint;
-	int bytes;
-	
-	while (*p) {
-		bytes = utf8_decode(p, &codepoint);
-		if (bytes == 0) {
-			p++;
-			continue;
-		}
-		if (codepoint == '\n') {
-			lineCount++;
-		}
-		p += bytes;
+	// The texture shader flips v, so the top edge takes 1 - v1.
+	float u0 = 0.0f, u1 = 1.0f, top = 0.0f, bottom = 1.0f;
+	if (params.uv) {
+		u0 = params.uv[0];
+		u1 = params.uv[2];
+		top = 1.0f - params.uv[3];
+		bottom = 1.0f - params.uv[1];
 	}
-	
-	params.y += lineCount * params.font->ascender * params.scale;
-	float lineStart = params.x;
-	
-	p = params.text;
-	while (*p) {
-		bytes = utf8_decode(p, &codepoint);
-		if (bytes == 0) {
-			p++;
-			continue;
-		}
-		
-		if (codepoint == '\n') {
-			params.x = lineStart;
-			params.y -= params.font->ascender * params.scale;
-			p += bytes;
-			continue;
-		}
-		Glyph *glyph = (Glyph *)hashmap_get(params.font->glyphs, (long long int)codepoint);
-		if (!glyph) {
-			p += bytes;
-			continue;
-		}
-
-		float xpos = params.x + glyph->bearingX * params.scale;
-		float ypos = params.y - (glyph->height - glyph->bearingY + params.font->descender) * params.scale;
 
-		float w = glyph->width * params.scale;
-		float h = glyph->height * params.scale;
-
-		GLfloat vertices[6][4] = {
-			{ xpos,     ypos + h,   0.0f, 0.0f },
-			{ xpos + w, ypos,       1.0f, 1.0f },
-			{ xpos,     ypos,       0.0f, 1.0f },
-
-			{ xpos,     ypos + h,   0.0f, 0.0f },
-			{ xpos + w, ypos + h,   1.0f, 0.0f },
-			{ xpos + w, ypos,       1.0f, 1.0f }
-		};
-		
-		glBindTexture(GL_TEXTURE_2D, glyph->textureID);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+	GLfloat vertices[6][4] = {
+		{ xpos,     ypos + h,   u0, top },
+		{ xpos + w, ypos,       u1, bottom },
+		{ xpos,     ypos,       u0, bottom },
 
-		params.x += (glyph->advance) * params.scale;
-		p += bytes;
-	}
-	glDisableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-	glDeleteBuffers(1, &VBO);
-	glDeleteVertexArrays(1, &VAO);
-	glUseProgram(0);
-}
+		{ xpos,     ypos + h,   u0, top },
+		{ xpos + w, ypos + h,   u1, top },
+		{ xpos + w, ypos,       u1, bottom }
+	};
 
-static inline void render_texture(textureRenderParameters params) {
-	GLuint VAO, VBO;
+	GLint first = stream_buffer_upload(win->quadStream, vertices, sizeof(vertices));
+	if (first < 0)
+		return;
 
-	glGenVertexArrays(1, &VAO);
-	glBindVertexArray(VAO);
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
-	glUseProgram(params.shaderProgram);
+	use_shader(params.shader, win);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, params.textureID);
 
-	int width, height;
-	glfwGetFramebufferSize(glfwGetCurrentContext(), &width, &height);
-	float screenSize[] = { (float)width, (float)height };
-	glUniform2fv(glGetUniformLocation(params.shaderProgram, "screenSize"), 1, screenSize);
-	glUniform3fv(glGetUniformLocation(params.shaderProgram, "tintColor"), 1, params.color);
-	glUniform1f(glGetUniformLocation(params.shaderProgram, "intensity"), params.intensity);
-
-
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	float xpos = params.x;
-	float ypos = params.y;
-
-	float w = params.width;
-	float h = params.height;
+	glUniform3fv(params.shader->uniforms[UNIFORM_TINT_COLOR], 1, params.color);
+	glUniform1f(params.shader->uniforms[UNIFORM_INTENSITY], params.intensity);
 
-	GLfloat vertices[6][4] = {
-		{ xpos,     ypos + h,   0.0f, 0.0f },
-		{ xpos + w, ypos,       1.0f, 1.0f },
-		{ xpos,     ypos,       0.0f, 1.0f },
+	if (params.premultiplied) {
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	} else {
+		set_alpha_blend(win);
+	}
 
-		{ xpos,     ypos + h,   0.0f, 0.0f },
-		{ xpos + w, ypos + h,   1.0f, 0.0f },
-		{ xpos + w, ypos,       1.0f, 1.0f }
-	};
-		
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+	glDrawArrays(GL_TRIANGLES, first, 6);
+	win->stats.drawCalls++;
 
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	
-	glDisableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
-	glDeleteBuffers(1, &VBO);
-	glDeleteVertexArrays(1, &VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glUseProgram(0);
 }
 
-static inline void render_line(GLuint lineShaderProgram, Line line, int width, int height) {
-	glUseProgram(lineShaderProgram);
-
-	glUniform3fv(glGetUniformLocation(lineShaderProgram, "lineColor"), 1, line.color);
-	glUniform1i(glGetUniformLocation(lineShaderProgram, "erase"), line.erase);
-	glEnable(GL_BLEND);
-	if (line.erase)
-		glBlendFunc(GL_ZERO, GL_ZERO);
-	else
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	glUniform2f(glGetUniformLocation(lineShaderProgram, "screenSize"), (float)width, (float)height);
-
-
-	GLuint VAO, VBO;
-	glGenVertexArrays(1, &VAO);
-	glBindVertexArray(VAO);
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	
-	printf("drawing line from (%d, %d) to (%d, %d) with thickness %.2f\n", line.start.x, line.start.y, line.end.x, line.end.y, line.thickness);
-	float dx = line.start.x - line.end.x;
-	float dy = line.start.y - line.end.y;
-	float length = sqrt(dx * dx + dy * dy);
-	
-	if (length > 0) {
-		float perpX = -dy / length * line.thickness * 0.5f;
-		float perpY = dx / length * line.thickness * 0.5f;
+void render_wrapped_text(Widget *widget, Window *win) {
+	TextLayout *layout = widget_text_layout(widget);
+	if (!layout)
+		return;
 
-		Position lineVertices[6] = {
-			{line.start.x + perpX, line.start.y + perpY},  // Top-left
-			{line.start.x - perpX, line.start.y - perpY},  // Bottom-left
-			{line.end.x + perpX, line.end.y + perpY},      // Top-right
+	text_batch_add_layout(win->textBatch, win->shaderPrograms[0], layout,
+		widget->position.x, widget->position.y, widget->text_color);
+	text_batch_flush(win->textBatch, win);
+}
 
-			{line.start.x - perpX, line.start.y - perpY},  // Bottom-left
-			{line.end.x - perpX, line.end.y - perpY},      // Bottom-right
-			{line.end.x + perpX, line.end.y + perpY}       // Top-right
-		};
+void render_text_with_resize(Widget *widget, Window *win) {
 
-		glBufferData(GL_ARRAY_BUFFER, 6 * sizeof(Position), lineVertices, GL_STATIC_DRAW);
-		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Position), (void*)0);
-		glEnableVertexAttribArray(0);
+}
 
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+void apply_clip_rect(Window *win) {
+	if (win->clip_depth == 0) {
+		glDisable(GL_SCISSOR_TEST);
+		return;
 	}
+	ClipRect *rect = &win->clip_stack[win->clip_depth - 1];
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(rect->x + win->clip_origin[0], rect->y + win->clip_origin[1], rect->width, rect->height);
+}
 
-	const int circleSegments = 16;
-	float radius = line.thickness * 0.5f;
-
-	for (int cap = 0; cap < 2; cap++) {
-		Position center = (cap == 0) ? line.start : line.end;
-
-		Position circleVertices[circleSegments * 3];
-
-		for (int i = 0; i < circleSegments; i++) {
-			float angle1 = (float)i / circleSegments * 2.0f * M_PI;
-			float angle2 = (float)(i + 1) / circleSegments * 2.0f * M_PI;
-
-			circleVertices[i * 3] = (Position){center.x, center.y};
-			circleVertices[i * 3 + 1] = (Position){
-				center.x + cos(angle1) * radius,
-				center.y + sin(angle1) * radius
-			};
-			circleVertices[i * 3 + 2] = (Position){
-				center.x + cos(angle2) * radius,
-				center.y + sin(angle2) * radius
-			};
-		}
-
-		glBufferData(GL_ARRAY_BUFFER, circleSegments * 3 * sizeof(Position), circleVertices, GL_STATIC_DRAW);
-		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Position), (void*)0);
-		glEnableVertexAttribArray(0);
-
-		glDrawArrays(GL_TRIANGLES, 0, circleSegments * 3);
+// Clip rectangles are in window coordinates and nest: each one is intersected
+// with the rectangle below it.
+void push_clip_rect(Window *win, float x, float y, float width, float height) {
+	if (win->clip_depth == CLIP_STACK_DEPTH) {
+		// Keeps pushes and pops balanced, the deepest rectangle stays in effect.
+		if (win->clip_overflow++ == 0)
+			fprintf(stderr, "Clip stack overflow\n");
+		return;
 	}
-		
-	glDisableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-	glDeleteBuffers(1, &VBO);
-	glDeleteVertexArrays(1, &VAO);
-
-	glUseProgram(0);
+	int x0 = (int)floorf(x);
+	int y0 = (int)floorf(y);
+	int x1 = (int)ceilf(x + width);
+	int y1 = (int)ceilf(y + height);
+	if (win->clip_depth > 0) {
+		ClipRect *parent = &win->clip_stack[win->clip_depth - 1];
+		if (x0 < parent->x) x0 = parent->x;
+		if (y0 < parent->y) y0 = parent->y;
+		if (x1 > parent->x + parent->width) x1 = parent->x + parent->width;
+		if (y1 > parent->y + parent->height) y1 = parent->y + parent->height;
+	}
+	win->clip_stack[win->clip_depth++] = (ClipRect){
+		x0, y0, x1 > x0 ? x1 - x0 : 0, y1 > y0 ? y1 - y0 : 0
+	};
+	apply_clip_rect(win);
 }
 
-void render_wrapped_text(Widget *widget, Window *win) {
-	textRenderParameters textParams = {
-		.shaderProgram = win->shaderPrograms[0],
-		.font = widget->font,
-		.scale = 1.0f,
-		.color = {widget->text_color[0], widget->text_color[1], widget->text_color[2]}
-	};
-	
-	int total_lines = line_count(widget->text, widget->size.width, widget->font->glyphs);
-	int line_index = 0;
-	
-	const char *text_ptr = widget->text;
-	
-	while (*text_ptr) {
-		const char *line_start = text_ptr;
-		const char *line_end = text_ptr;
-		
-		while (*line_end && *line_end != '\n') {
-			uint32_t codepoint;
-			int bytes = utf8_decode(line_end, &codepoint);
-			if (bytes > 0) {
-				line_end += bytes;
-			} else {
-				line_end++;
-			}
-		}
-		
-		int line_length = line_end - line_start;
-		char *current_line = malloc(line_length + 1);
-		strncpy(current_line, line_start, line_length);
-		current_line[line_length] = '\0';
-		
-		const char *line_ptr = current_line;
-		
-		while (*line_ptr) {
-			int segment_width = 0;
-			const char *char_start = line_ptr;
-			const char *char_end = line_ptr;
-			
-			while (*char_end) {
-				uint32_t codepoint;
-				int bytes = utf8_decode(char_end, &codepoint);
-				if (bytes == 0) {
-					char_end++;
-					continue;
-				}
-				
-				Glyph *glyph = (Glyph *)hashmap_get(widget->font->glyphs, (long long int)codepoint);
-				if (!glyph) {
-					char_end += bytes;
-					continue;
-				}
-				
-				if (segment_width + glyph->advance > widget->size.width) {
-					break;
-				}
-				
-				segment_width += glyph->advance;
-				char_end += bytes;
-			}
-			
-			int segment_length = char_end - char_start;
-			if (segment_length > 0) {
-				char *substr = malloc(segment_length + 1);
-				strncpy(substr, char_start, segment_length);
-				substr[segment_length] = '\0';
-				
-				int offset_x = get_alignment_offset_x(widget->text_alignment, widget->size, substr, widget->font);
-				int offset_y = get_alignment_offset_y(widget->text_alignment, widget->size, widget->font->ascender, total_lines, line_index);
-				textParams.text = substr;
-				textParams.x = widget->position.x + offset_x;
-				textParams.y = widget->position.y + offset_y;
-				render_text(textParams);
-				
-				free(substr);
-			}
-			line_index++;
-			line_ptr = char_end;
-			
-			if (char_end == char_start) {
-				if (*line_ptr) {
-					uint32_t codepoint;
-					int bytes = utf8_decode(line_ptr, &codepoint);
-					line_ptr += (bytes > 0) ? bytes : 1;
-				}
-			}
-		}
-		
-		free(current_line);
-		
-		text_ptr = line_end;
-		if (*text_ptr == '\n') {
-			text_ptr++;
-		}
+void pop_clip_rect(Window *win) {
+	if (win->clip_overflow > 0) {
+		win->clip_overflow--;
+		return;
 	}
+	if (win->clip_depth == 0) return;
+	win->clip_depth--;
+	apply_clip_rect(win);
 }
 
-void render_text_with_resize(Widget *widget, Window *win) {
+// Non-rectangular masks go through the stencil buffer, plain rectangles only need the scissor.
+static inline void begin_widget_clip(Widget *widget, Window *win) {
+	push_clip_rect(win, widget->position.x, widget->position.y, widget->size.width, widget->size.height);
+	if (!widget->clip_mask)
+		return;
 
-}
-
-static inline void set_bound(textureRenderParameters params) {	
 	glEnable(GL_STENCIL_TEST);
 	glClear(GL_STENCIL_BUFFER_BIT);
 	glStencilMask(0xFF);
@@ -348,47 +130,197 @@ static inline void set_bound(textureRenderParameters params) {
 	glStencilFunc(GL_ALWAYS, 1, 0xFF);
 	glStencilOp(GL_REPLACE, GL_REPLACE, GL_REPLACE);
 
-	render_texture(params);
-	
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glDepthMask(GL_TRUE);
-	glStencilFunc(GL_EQUAL, 1, 0xFF);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-}
-
-int render_widget(Widget *widget, Window *win) {
-	if (!widget || !win) return -1;
-
 	textureRenderParameters params = {
-		.shaderProgram = win->shaderPrograms[1],
+		.shader = win->shaderPrograms[1],
 		.x = widget->position.x,
 		.y = widget->position.y,
 		.width = widget->size.width,
 		.height = widget->size.height,
 		.color = { 0.0f, 0.0f, 0.0f },
 		.intensity = 0.0f,
-		.textureID = 0
+		.textureID = widget->clip_mask
 	};
-	set_bound(params);
+	render_texture(win, params);
+	
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+	glStencilFunc(GL_EQUAL, 1, 0xFF);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+}
+
+static inline void end_widget_clip(Widget *widget, Window *win) {
+	if (widget->clip_mask)
+		glDisable(GL_STENCIL_TEST);
+	pop_clip_rect(win);
+}
+
+static inline float background_intensity(Widget *widget) {
+	return widget->render_func == render_widget ? widget->state * 0.4f : 0.0f;
+}
 
+static inline bool background_batchable(Widget *widget) {
+	return !widget->retained && !widget->clip_mask &&
+		(widget->render_func == render_widget || widget->render_func == render_canvas || widget->render_func == render_textbox);
+}
+
+static void render_background(Widget *widget, Window *win) {
+	// Already drawn by the instanced pass of render_context.
+	if (win->backgrounds_batched && !win->offscreen && background_batchable(widget))
+		return;
+
+	const Skin *skin = skin_atlas_get(win->skins, widget->texture_index);
 	textureRenderParameters textureParams = {
-		.shaderProgram = win->shaderPrograms[1],
+		.shader = win->shaderPrograms[1],
 		.x = widget->position.x,
 		.y = widget->position.y,
 		.width = widget->size.width,
 		.height = widget->size.height,
 		.color = { 0.0f, 0.0f, 0.0f },
-		.intensity = (widget->state * 0.4f),
-		.textureID = win->textures[widget->texture_index]
+		.intensity = background_intensity(widget),
+		.textureID = skin->texture,
+		.uv = skin->uv
 	};
-	render_texture(textureParams);
+	render_texture(win, textureParams);
+}
+
+int render_widget(Widget *widget, Window *win) {
+	if (!widget || !win) return -1;
+
+	begin_widget_clip(widget, win);
+
+	render_background(widget, win);
 	render_wrapped_text(widget, win);
 
-	glDisable(GL_STENCIL_TEST);
+	end_widget_clip(widget, win);
 
 	return 0;
 }
 
+// Rebuilds the pyramid tiles queued by rasterize_canvas_tiles from their four children.
+// Each child lands in one quadrant, linear filtering averages its 2x2 texel blocks,
+// which is only right on premultiplied texels: straight ones would pull transparent
+// black into stroke edges.
+static void update_canvas_pyramid(Window *win, canvasData *canvas) {
+	int half = CANVAS_TILE_SIZE / 2;
+	glViewport(0, 0, CANVAS_TILE_SIZE, CANVAS_TILE_SIZE);
+	set_frame_size(win, CANVAS_TILE_SIZE, CANVAS_TILE_SIZE);
+	for (int i = 0; i < canvas->touchedCount; i++) {
+		CanvasTile *parent = canvas->touched[i];
+		parent->touched = false;
+		if (parent->level == 0)
+			continue;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, parent->FBO);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		for (int quadrant = 0; quadrant < 4; quadrant++) {
+			int x = parent->x * 2 + (quadrant & 1);
+			int y = parent->y * 2 + (quadrant >> 1);
+			CanvasTile *child = hashmap_get(canvas->tiles, tile_key(parent->level - 1, x, y));
+			if (!child)
+				continue;
+			textureRenderParameters params = {
+				.shader = win->shaderPrograms[1],
+				.x = (quadrant & 1) * half,
+				.y = (quadrant >> 1) * half,
+				.width = half,
+				.height = half,
+				.color = { 1.0f, 1.0f, 1.0f },
+				.intensity = 0.0f,
+				.textureID = child->texture,
+				.premultiplied = true
+			};
+			render_texture(win, params);
+		}
+	}
+	canvas->touchedCount = 0;
+}
+
+// Draws the tiles of the pyramid level closest to the zoom that intersect the widget.
+static void render_canvas_tiles(Widget *widget, Window *win, canvasData *canvas) {
+	int level = 0;
+	while (level + 1 < CANVAS_PYRAMID_LEVELS && canvas->zoom * (1 << (level + 1)) <= 1.0f)
+		level++;
+	float span = (float)(CANVAS_TILE_SIZE << level); // canvas pixels per tile
+	float size = span * canvas->zoom; // window pixels per tile
+
+	float right = canvas->viewX + widget->size.width / canvas->zoom;
+	float top = canvas->viewY + widget->size.height / canvas->zoom;
+	// Clamped in float to the tiles the level has, so far views and tiny zooms
+	// neither overflow the conversion nor walk tiles that cannot exist.
+	float columns = ceilf(widget->size.width / span), rows = ceilf(widget->size.height / span);
+	int x0 = (int)fminf(fmaxf(floorf(canvas->viewX / span), 0.0f), columns);
+	int x1 = (int)fminf(fmaxf(floorf(right / span), -1.0f), columns - 1.0f);
+	int y0 = (int)fminf(fmaxf(floorf(canvas->viewY / span), 0.0f), rows);
+	int y1 = (int)fminf(fmaxf(floorf(top / span), -1.0f), rows - 1.0f);
+
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) {
+			CanvasTile *tile = hashmap_get(canvas->tiles, tile_key(level, x, y));
+			if (!tile)
+				continue;
+			textureRenderParameters textureParams = {
+				.shader = win->shaderPrograms[1],
+				.x = widget->position.x + (x * span - canvas->viewX) * canvas->zoom,
+				.y = widget->position.y + (y * span - canvas->viewY) * canvas->zoom,
+				.width = (int)ceilf(size),
+				.height = (int)ceilf(size),
+				.color = { 1.0f, 1.0f, 1.0f },
+				.intensity = 0.0f,
+				.textureID = tile->texture,
+				.premultiplied = true
+			};
+			render_texture(win, textureParams);
+		}
+	}
+}
+
+// Shows the part of the bitmap the view selects, scaled to the widget.
+static void render_canvas_bitmap(Widget *widget, Window *win, canvasData *canvas) {
+	float width = widget->size.width, height = widget->size.height;
+	float left = fmaxf(canvas->viewX, 0.0f);
+	float bottom = fmaxf(canvas->viewY, 0.0f);
+	float right = fminf(canvas->viewX + width / canvas->zoom, width);
+	float top = fminf(canvas->viewY + height / canvas->zoom, height);
+	if (right <= left || top <= bottom)
+		return;
+
+	float uv[4] = { left / width, bottom / height, right / width, top / height };
+	textureRenderParameters textureParams = {
+		.shader = win->shaderPrograms[1],
+		.x = widget->position.x + (left - canvas->viewX) * canvas->zoom,
+		.y = widget->position.y + (bottom - canvas->viewY) * canvas->zoom,
+		.width = (int)roundf((right - left) * canvas->zoom),
+		.height = (int)roundf((top - bottom) * canvas->zoom),
+		.color = { 1.0f, 1.0f, 1.0f },
+		.intensity = 0.0f,
+		.textureID = canvas->bitmap,
+		.uv = uv
+	};
+	render_texture(win, textureParams);
+}
+
+static void draw_canvas_commands(Widget *widget, Window *win, canvasData *canvas, const CommandBuffer *commands, bool sdf) {
+	if (canvas->tiles) {
+		rasterize_canvas_tiles(win, canvas, commands, widget->size, sdf);
+		update_canvas_pyramid(win, canvas);
+		return;
+	}
+
+	if (canvas->history.budget > 0)
+		record_canvas_rect(canvas, commands, widget->size);
+	// The bitmap is exported as is, so it keeps straight blending even inside a widget cache.
+	bool offscreen = win->offscreen;
+	win->offscreen = false;
+	glBindFramebuffer(GL_FRAMEBUFFER, canvas->FBO);
+	glViewport(0, 0, widget->size.width, widget->size.height);
+	set_frame_size(win, widget->size.width, widget->size.height);
+	line_batch_begin(win->lineBatch, sdf, (Position){ 0.0f, 0.0f });
+	add_canvas_commands(win->lineBatch, commands, NULL);
+	line_batch_flush(win->lineBatch, sdf ? win->shaderPrograms[4] : win->shaderPrograms[2], win);
+	win->offscreen = offscreen;
+}
+
 int render_canvas(Widget *widget, Window *win) {
 	if (!widget || !win) return -1;
 
@@ -403,61 +335,64 @@ int render_canvas(Widget *widget, Window *win) {
 		return -1;
 	}
 
-	textureRenderParameters params = {
-		.shaderProgram = win->shaderPrograms[1],
-		.x = widget->position.x,
-		.y = widget->position.y,
-		.width = widget->size.width,
-		.height = widget->size.height,
-		.color = { 0.0f, 0.0f, 0.0f },
-		.intensity = 0.0f,
-		.textureID = 0
-	};
-	set_bound(params);
+	begin_widget_clip(widget, win);
 
-	textureRenderParameters textureParams = {
-		.shaderProgram = win->shaderPrograms[1],
-		.x = widget->position.x,
-		.y = widget->position.y,
-		.width = widget->size.width,
-		.height = widget->size.height,
-		.color = { 0.0f, 0.0f, 0.0f },
-		.intensity = 0.0f,
-		.textureID = win->textures[widget->texture_index]
-	};
-	render_texture(textureParams);
+	render_background(widget, win);
 
-	if (canvas->lineQueue) {
+	if (canvas->commands.count > 0 || canvas->exports) {
 		GLint viewport[4];
 		glGetIntegerv(GL_VIEWPORT, viewport);
-		glBindFramebuffer(GL_FRAMEBUFFER, canvas->FBO);
-		glViewport(0, 0, widget->size.width, widget->size.height);
-
-		while (canvas->lineQueue) {
-			Line line = canvas->lineQueue->val;
-			render_line(win->shaderPrograms[2], line, widget->size.width, widget->size.height);
-			dequeue_line(&canvas->lineQueue);
+		glDisable(GL_SCISSOR_TEST);
+		Size frameSize = win->frameSize;
+
+		if (canvas->minSegment > 0.0f || canvas->tolerance > 0.0f)
+			command_buffer_simplify(&canvas->commands, canvas->minSegment, canvas->tolerance);
+		bool sdf = canvas->lineMode == LINE_SDF && win->shaderPrograms[4];
+
+		// Strokes between two undo or redo commands are drawn as one batch and one history step.
+		CommandBuffer *commands = &canvas->commands;
+		int start = 0;
+		for (int i = 0; i <= commands->count; i++) {
+			bool history = i < commands->count &&
+				(commands->commands[i].type == CANVAS_UNDO || commands->commands[i].type == CANVAS_REDO);
+			if (i < commands->count && !history)
+				continue;
+			if (i > start) {
+				CommandBuffer segment = *commands;
+				segment.commands += start;
+				segment.count = i - start;
+				draw_canvas_commands(widget, win, canvas, &segment, sdf);
+			}
+			if (history && swap_canvas_history(canvas, commands->commands[i].type == CANVAS_UNDO) == 0 && canvas->tiles) {
+				queue_canvas_ancestors(canvas);
+				update_canvas_pyramid(win, canvas);
+			}
+			start = i + 1;
+		}
+		command_buffer_reset(commands);
+
+		if (canvas->exports && canvas->tiles) {
+			fprintf(stderr, "Tiled canvases cannot be exported\n");
+			cancel_canvas_exports(canvas);
+		} else if (canvas->exports) {
+			glBindFramebuffer(GL_FRAMEBUFFER, canvas->FBO);
+			issue_canvas_exports((Ck *)glfwGetWindowUserPointer(win->window), canvas, widget->size.width, widget->size.height);
 		}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, win->framebuffer);
 		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		set_frame_size(win, frameSize.width, frameSize.height);
+		apply_clip_rect(win);
 	}
 
-	textureParams = (textureRenderParameters){
-		.shaderProgram = win->shaderPrograms[1],
-		.x = widget->position.x,
-		.y = widget->position.y,
-		.width = widget->size.width,
-		.height = widget->size.height,
-		.color = { 1.0f, 1.0f, 1.0f },
-		.intensity = 0.0f,
-		.textureID = canvas->bitmap
-	};
-	render_texture(textureParams);
+	if (canvas->tiles)
+		render_canvas_tiles(widget, win, canvas);
+	else
+		render_canvas_bitmap(widget, win, canvas);
 
 	render_wrapped_text(widget, win);
 
-	glDisable(GL_STENCIL_TEST);
+	end_widget_clip(widget, win);
 
 	return 0;
 }
@@ -471,36 +406,82 @@ int render_textbox(Widget *widget, Window *win) {
 
 	textboxData *data = (textboxData *)widget->data;
 
-	textureRenderParameters params = {
-		.shaderProgram = win->shaderPrograms[1],
-		.x = widget->position.x,
-		.y = widget->position.y,
-		.width = widget->size.width,
-		.height = widget->size.height,
-		.color = { 0.0f, 0.0f, 0.0f },
-		.intensity = 0.0f,
-		.textureID = 0
-	};
-	set_bound(params);
+	begin_widget_clip(widget, win);
 
-	textureRenderParameters textureParams = {
-		.shaderProgram = win->shaderPrograms[1],
-		.x = widget->position.x,
-		.y = widget->position.y,
-		.width = widget->size.width,
-		.height = widget->size.height,
-		.color = { 0.0f, 0.0f, 0.0f },
-		.intensity = 0.0f,
-		.textureID = win->textures[widget->texture_index]
-	};
-	render_texture(textureParams);
+	render_background(widget, win);
 
 	if (!data->autoresize)
 		render_wrapped_text(widget, win);
-	else
 
-	glDisable(GL_STENCIL_TEST);
-	
+	end_widget_clip(widget, win);
+
+	return 0;
+}
+
+static int render_retained_widget(Widget *widget, Window *win) {
+	RenderTarget *target = widget->cache;
+	if (!target || target->width != widget->size.width || target->height != widget->size.height) {
+		destroy_render_target(target);
+		target = widget->cache = create_render_target(widget->size.width, widget->size.height);
+		if (!target)
+			return widget->render_func(widget, win);
+	}
+
+	int x = (int)floorf(widget->position.x);
+	int y = (int)floorf(widget->position.y);
+
+	if (!target->valid) {
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		GLuint framebuffer = win->framebuffer;
+		bool offscreen = win->offscreen;
+		int clip_depth = win->clip_depth;
+		int clip_overflow = win->clip_overflow;
+		int clip_origin[2] = { win->clip_origin[0], win->clip_origin[1] };
+
+		// Shift the viewport so the widget keeps drawing in window coordinates
+		// while only its own rectangle lands in the cache. The cache holds the
+		// whole widget, clipping by enclosing rectangles happens when compositing.
+		glBindFramebuffer(GL_FRAMEBUFFER, target->FBO);
+		glViewport(viewport[0] - x, viewport[1] - y, viewport[2], viewport[3]);
+		glDisable(GL_SCISSOR_TEST);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		win->framebuffer = target->FBO;
+		win->offscreen = true;
+		win->clip_depth = 0;
+		win->clip_overflow = 0;
+		win->clip_origin[0] = viewport[0] - x;
+		win->clip_origin[1] = viewport[1] - y;
+
+		int result = widget->render_func(widget, win);
+
+		win->framebuffer = framebuffer;
+		win->offscreen = offscreen;
+		win->clip_depth = clip_depth;
+		win->clip_overflow = clip_overflow;
+		win->clip_origin[0] = clip_origin[0];
+		win->clip_origin[1] = clip_origin[1];
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		apply_clip_rect(win);
+		if (result != 0)
+			return result;
+		target->valid = true;
+	}
+
+	textureRenderParameters params = {
+		.shader = win->shaderPrograms[1],
+		.x = x,
+		.y = y,
+		.width = target->width,
+		.height = target->height,
+		.color = { 0.0f, 0.0f, 0.0f },
+		.intensity = 0.0f,
+		.textureID = target->texture,
+		.premultiplied = true
+	};
+	render_texture(win, params);
 	return 0;
 }
 
@@ -515,15 +496,34 @@ static inline int render_context(Context *ctx, Window *win) {
 		return 0;
 	}
 
+	win->backgrounds_batched = ctx->batch_backgrounds && win->shaderPrograms[3];
+	if (win->backgrounds_batched) {
+		for (int i = 0; i < ctx->widget_count; i++) {
+			Widget *widget = ctx->widgets[i];
+			if (!background_batchable(widget))
+				continue;
+			const float tint[3] = { 0.0f, 0.0f, 0.0f };
+			instance_batch_add(win->backgroundBatch, skin_atlas_get(win->skins, widget->texture_index),
+				widget->position.x, widget->position.y, widget->size.width, widget->size.height,
+				tint, background_intensity(widget));
+		}
+		instance_batch_flush(win->backgroundBatch, win->shaderPrograms[3], win);
+	}
+
 	for (int i = 0; i < ctx->widget_count; i++) {
 		if (ctx->widgets[i]->render_func) {
 			signal_emit(ctx->widgets[i], REDRAW);
-			if (ctx->widgets[i]->render_func(ctx->widgets[i], win) != 0) {
+			int (*render_func)(Widget *, Window *) = ctx->widgets[i]->retained ? render_retained_widget : ctx->widgets[i]->render_func;
+			if (render_func(ctx->widgets[i], win) != 0) {
 				fprintf(stderr, "Widget %d render function failed\n", i);
+				win->backgrounds_batched = false;
 				return -1;
 			}
 		}
+		ctx->widgets[i]->dirty = false;
 	}
+	win->backgrounds_batched = false;
+	ctx->dirty = false;
 
 	return 0;
 }
@@ -533,9 +533,22 @@ int render_window(Window *win) {
 		return -1;
 	}
 	signal_emit(win, REDRAW);
+	win->dirty = false;
+	win->rendered_context = win->context;
+	win->stats = (RenderStats){0};
 	glfwMakeContextCurrent(win->window);
+
+	int width, height;
+	glfwGetFramebufferSize(win->window, &width, &height);
+	set_frame_size(win, width, height);
+
 	glClearColor(win->context->clear_color[0], win->context->clear_color[1],
 				 win->context->clear_color[2], win->context->clear_color[3]);
+	win->clip_depth = 0;
+	win->clip_overflow = 0;
+	win->clip_origin[0] = 0;
+	win->clip_origin[1] = 0;
+	apply_clip_rect(win);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	if (win->context) {
 		if (render_context(win->context, win) != 0) {
@@ -543,4 +556,9 @@ int render_window(Window *win) {
 		}
 	}
 	return 0;
-}
\ No newline at end of file
+}
+
+bool window_needs_redraw(Window *win) {
+	if (!win) return false;
+	return win->dirty || win->context != win->rendered_context || (win->context && win->context->dirty);
+}
@@ -0,0 +1,142 @@
+#include "../libs/ck.h"
+#include "../libs/ck_internal.h"
+#include "../libs/external/stb_image.h"
+
+static const Skin missing_skin = { 0, { 0.0f, 0.0f, 1.0f, 1.0f }, false };
+
+SkinAtlas *skin_atlas_create() {
+	SkinAtlas *atlas = calloc(1, sizeof(SkinAtlas));
+	if (!atlas) {
+		fprintf(stderr, "Failed to allocate memory for SkinAtlas\n");
+		return NULL;
+	}
+	return atlas;
+}
+
+void skin_atlas_destroy(SkinAtlas *atlas) {
+	if (!atlas) return;
+	for (int i = 0; i < atlas->skinCount; i++) {
+		if (atlas->skins[i].standalone)
+			glDeleteTextures(1, &atlas->skins[i].texture);
+	}
+	if (atlas->pageCount > 0)
+		glDeleteTextures(atlas->pageCount, atlas->pages);
+	free(atlas->pages);
+	free(atlas->skins);
+	free(atlas);
+}
+
+const Skin *skin_atlas_get(SkinAtlas *atlas, int index) {
+	if (!atlas || index < 0 || index >= atlas->skinCount)
+		return &missing_skin;
+	return &atlas->skins[index];
+}
+
+static inline int add_skin_page(SkinAtlas *atlas) {
+	GLuint *pages = realloc(atlas->pages, sizeof(GLuint) * (atlas->pageCount + 1));
+	if (!pages) {
+		fprintf(stderr, "Failed to allocate memory for skin atlas pages\n");
+		return -1;
+	}
+	atlas->pages = pages;
+	atlas->pages[atlas->pageCount] = generate_texture(SKIN_ATLAS_SIZE, SKIN_ATLAS_SIZE, NULL);
+	atlas->pageCount++;
+	// Skins carry their own border, see pack_skin.
+	atlas_packer_init(&atlas->packer, SKIN_ATLAS_SIZE, SKIN_ATLAS_SIZE, 0);
+	return 0;
+}
+
+// Copies the image with its outermost texels repeated once on every side,
+// so linear filtering at the edge of a skin never reads its neighbours.
+static unsigned char *extrude_skin(const unsigned char *data, int width, int height) {
+	int paddedWidth = width + 2 * SKIN_ATLAS_PADDING;
+	int paddedHeight = height + 2 * SKIN_ATLAS_PADDING;
+	unsigned char *padded = malloc((size_t)paddedWidth * paddedHeight * 4);
+	if (!padded) {
+		fprintf(stderr, "Failed to allocate memory for skin border\n");
+		return NULL;
+	}
+	for (int y = 0; y < paddedHeight; y++) {
+		int sy = y - SKIN_ATLAS_PADDING;
+		sy = sy < 0 ? 0 : (sy >= height ? height - 1 : sy);
+		for (int x = 0; x < paddedWidth; x++) {
+			int sx = x - SKIN_ATLAS_PADDING;
+			sx = sx < 0 ? 0 : (sx >= width ? width - 1 : sx);
+			memcpy(&padded[((size_t)y * paddedWidth + x) * 4], &data[((size_t)sy * width + sx) * 4], 4);
+		}
+	}
+	return padded;
+}
+
+static int pack_skin(SkinAtlas *atlas, Skin *skin, const unsigned char *data, int width, int height) {
+	int paddedWidth = width + 2 * SKIN_ATLAS_PADDING;
+	int paddedHeight = height + 2 * SKIN_ATLAS_PADDING;
+
+	// Too large to share a page, keep it in a texture of its own.
+	if (paddedWidth > SKIN_ATLAS_SIZE || paddedHeight > SKIN_ATLAS_SIZE) {
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		skin->texture = generate_texture(width, height, data);
+		skin->uv[0] = skin->uv[1] = 0.0f;
+		skin->uv[2] = skin->uv[3] = 1.0f;
+		skin->standalone = true;
+		return 0;
+	}
+
+	int x, y;
+	if (atlas->pageCount == 0 || atlas_packer_insert(&atlas->packer, paddedWidth, paddedHeight, &x, &y) != 0) {
+		if (add_skin_page(atlas) != 0)
+			return -1;
+		if (atlas_packer_insert(&atlas->packer, paddedWidth, paddedHeight, &x, &y) != 0)
+			return -1;
+	}
+
+	unsigned char *padded = extrude_skin(data, width, height);
+	if (!padded)
+		return -1;
+
+	skin->texture = atlas->pages[atlas->pageCount - 1];
+	glBindTexture(GL_TEXTURE_2D, skin->texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, paddedWidth, paddedHeight, GL_RGBA, GL_UNSIGNED_BYTE, padded);
+	free(padded);
+
+	skin->uv[0] = (float)(x + SKIN_ATLAS_PADDING) / SKIN_ATLAS_SIZE;
+	skin->uv[1] = (float)(y + SKIN_ATLAS_PADDING) / SKIN_ATLAS_SIZE;
+	skin->uv[2] = (float)(x + SKIN_ATLAS_PADDING + width) / SKIN_ATLAS_SIZE;
+	skin->uv[3] = (float)(y + SKIN_ATLAS_PADDING + height) / SKIN_ATLAS_SIZE;
+	skin->standalone = false;
+	return 0;
+}
+
+int skin_atlas_load(SkinAtlas *atlas, const char *path) {
+	if (!atlas || !path) return -1;
+
+	if (atlas->skinCount == atlas->skinCapacity) {
+		int capacity = atlas->skinCapacity ? atlas->skinCapacity * 2 : 8;
+		Skin *skins = realloc(atlas->skins, sizeof(Skin) * capacity);
+		if (!skins) {
+			fprintf(stderr, "Failed to allocate memory for skins\n");
+			return -1;
+		}
+		atlas->skins = skins;
+		atlas->skinCapacity = capacity;
+	}
+
+	int width, height, channels;
+	stbi_set_flip_vertically_on_load(1);
+	// Pages are RGBA, expand every image to four channels.
+	unsigned char *data = stbi_load(path, &width, &height, &channels, 4);
+	if (!data) {
+		fprintf(stderr, "Failed to load image: %s\n", path);
+		return -1;
+	}
+
+	Skin *skin = &atlas->skins[atlas->skinCount];
+	int result = pack_skin(atlas, skin, data, width, height);
+	stbi_image_free(data);
+	if (result != 0) {
+		fprintf(stderr, "Failed to pack skin: %s\n", path);
+		return -1;
+	}
+	return atlas->skinCount++;
+}
@@ -0,0 +1,44 @@
+#include "../libs/ck.h"
+#include "../libs/ck_internal.h"
+
+RenderTarget *create_render_target(int width, int height) {
+	RenderTarget *target = malloc(sizeof(RenderTarget));
+	if (!target) {
+		fprintf(stderr, "Failed to allocate memory for RenderTarget\n");
+		return NULL;
+	}
+	target->width = width;
+	target->height = height;
+	target->valid = false;
+
+	target->texture = generate_texture(width, height, NULL);
+
+	glGenRenderbuffers(1, &target->stencil);
+	glBindRenderbuffer(GL_RENDERBUFFER, target->stencil);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	GLint previous;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+	glGenFramebuffers(1, &target->FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->FBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target->texture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target->stencil);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Framebuffer is not complete\n");
+		destroy_render_target(target);
+		return NULL;
+	}
+	return target;
+}
+
+void destroy_render_target(RenderTarget *target) {
+	if (!target) return;
+	glDeleteFramebuffers(1, &target->FBO);
+	glDeleteRenderbuffers(1, &target->stencil);
+	glDeleteTextures(1, &target->texture);
+	free(target);
+}
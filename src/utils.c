@@ -113,12 +113,36 @@ GLuint load_texture(const char* filename) {
 	return texture;
 }
 
-GLuint load_shader(const char* vertexPath, const char* fragmentPath) {
+static const char *uniform_names[UNIFORM_COUNT] = {
+	[UNIFORM_SCREEN_SIZE] = "screenSize",
+	[UNIFORM_TEXT_COLOR] = "textColor",
+	[UNIFORM_TINT_COLOR] = "tintColor",
+	[UNIFORM_INTENSITY] = "intensity",
+	[UNIFORM_LINE_COLOR] = "lineColor",
+	[UNIFORM_ERASE] = "erase"
+};
+
+Shader *load_shader(const char* vertexPath, const char* fragmentPath) {
+	char* vertexCode = read_file(vertexPath);
+	char* fragmentCode = read_file(fragmentPath);
+	if (!vertexCode || !fragmentCode) {
+		free(vertexCode);
+		free(fragmentCode);
+		return NULL;
+	}
+
+	Shader *shader = malloc(sizeof(Shader));
+	if (!shader) {
+		fprintf(stderr, "Failed to allocate memory for Shader\n");
+		free(vertexCode);
+		free(fragmentCode);
+		return NULL;
+	}
+
 	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
 	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 	GLuint shaderProgram = glCreateProgram();
 
-	char* vertexCode = read_file(vertexPath);
 	glShaderSource(vertexShader, 1, (const char**)&vertexCode, NULL);
 	glCompileShader(vertexShader);
 	
@@ -130,7 +154,6 @@ GLuint load_shader(const char* vertexPath, const char* fragmentPath) {
 		printf("ERROR::SHADER::VERTEX::COMPILATION_FAILED\n%s\n%s\n\n", infoLog, vertexPath);
 	}
 
-	char* fragmentCode = read_file(fragmentPath);
 	glShaderSource(fragmentShader, 1, (const char**)&fragmentCode, NULL);
 	glCompileShader(fragmentShader);
 	
@@ -143,19 +166,63 @@ GLuint load_shader(const char* vertexPath, const char* fragmentPath) {
 	glAttachShader(shaderProgram, vertexShader);
 	glAttachShader(shaderProgram, fragmentShader);
 	glLinkProgram(shaderProgram);
+
+	free(vertexCode);
+	free(fragmentCode);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
 	
 	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
 	if (!success) {
 		glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
 		printf("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s\n", infoLog);
+		glDeleteProgram(shaderProgram);
+		free(shader);
+		return NULL;
 	}
 
-	free(vertexCode);
-	free(fragmentCode);
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
+	shader->program = shaderProgram;
+	for (int i = 0; i < UNIFORM_COUNT; i++)
+		shader->uniforms[i] = glGetUniformLocation(shaderProgram, uniform_names[i]);
+
+	// Programs that declare the FrameData block read the screen size from the
+	// per-frame uniform buffer instead of their own screenSize uniform.
+	shader->frameBlock = glGetUniformBlockIndex(shaderProgram, "FrameData");
+	if (shader->frameBlock != GL_INVALID_INDEX)
+		glUniformBlockBinding(shaderProgram, shader->frameBlock, FRAME_UNIFORM_BINDING);
+	shader->screenSize[0] = -1.0f;
+	shader->screenSize[1] = -1.0f;
+
+	return shader;
+}
+
+void destroy_shader(Shader *shader) {
+	if (!shader) return;
+	glDeleteProgram(shader->program);
+	free(shader);
+}
+
+void use_shader(Shader *shader, Window *win) {
+	glUseProgram(shader->program);
+	if (shader->frameBlock != GL_INVALID_INDEX || shader->uniforms[UNIFORM_SCREEN_SIZE] < 0)
+		return;
+	if (shader->screenSize[0] != win->frameSize.width || shader->screenSize[1] != win->frameSize.height) {
+		shader->screenSize[0] = win->frameSize.width;
+		shader->screenSize[1] = win->frameSize.height;
+		glUniform2fv(shader->uniforms[UNIFORM_SCREEN_SIZE], 1, shader->screenSize);
+	}
+}
+
+void set_frame_size(Window *win, int width, int height) {
+	win->frameSize.width = width;
+	win->frameSize.height = height;
 
-	return shaderProgram;
+	// std140 pads the vec2 to a full vec4 slot.
+	GLfloat frameData[4] = { (GLfloat)width, (GLfloat)height, 0.0f, 0.0f };
+	glBindBuffer(GL_UNIFORM_BUFFER, win->frameUniforms);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frameData), frameData);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, win->frameUniforms);
 }
 
 GLuint generate_texture(int width, int height, const unsigned char* data) {
@@ -207,44 +274,133 @@ Window* ck_window_under_cursor(Ck* ck) {
 	return NULL;
 }
 
-void mouse_state_check(Window *win) {
-	static int last_state;
-	if (!win || !win->context) return;
-	if (!glfwGetWindowAttrib(win->window, GLFW_FOCUSED)) return;
-	int left = glfwGetMouseButton(win->window, GLFW_MOUSE_BUTTON_LEFT);
-	int right = glfwGetMouseButton(win->window, GLFW_MOUSE_BUTTON_RIGHT);
-
-	Position mousePos = mouse_position(win);
-
-	int on_widget = 0;
-
-	for (int i = 0; i < win->context->widget_count; i++) {
-		Widget *widget = win->context->widgets[i];
-		if (mousePos.x >= widget->position.x && mousePos.x <= widget->position.x + widget->size.width &&
-			mousePos.y >= widget->position.y && mousePos.y <= widget->position.y + widget->size.height) {
-			on_widget = 1;
-			if (left == GLFW_PRESS) {
-				if (last_state != GLFW_PRESS) {
-					widget->state = 2;
-					signal_emit(widget, CLICK);
-				}
-			} else {
-				widget->state = 1;
-				signal_emit(widget, HOVER);
-			}
-		} else {
-			if (widget->state != 0) {
-				widget->state = 0;
-			}
+static inline bool widget_contains(const Widget *widget, Position position) {
+	return position.x >= widget->position.x && position.x <= widget->position.x + widget->size.width &&
+		position.y >= widget->position.y && position.y <= widget->position.y + widget->size.height;
+}
+
+static const InputEvent *current_event = NULL;
+
+const InputEvent *input_event() {
+	return current_event;
+}
+
+// Recomputes widget states for the cursor, press is set for the event pressing the
+// left button. Returns whether the cursor is over any widget.
+static bool update_widget_states(Window *win, bool press) {
+	Context *ctx = win->context;
+	if (!ctx) return false;
+	HitGrid *grid = ctx->hit_grid;
+	win->hitContext = ctx;
+	win->hitVersion = grid->version;
+
+	// Only widgets the cursor was over can need resetting.
+	for (int i = grid->activeCount - 1; i >= 0; i--) {
+		Widget *widget = grid->active[i];
+		if (!win->cursorInside || !widget_contains(widget, win->cursor)) {
+			widget->state = 0;
+			invalidate_widget(widget);
+			grid->active[i] = grid->active[--grid->activeCount];
 		}
 	}
+	if (!win->cursorInside)
+		return false;
+
+	bool on_widget = false;
+	bool held = win->buttons & (1 << GLFW_MOUSE_BUTTON_LEFT);
+	int count;
+	int hits = 0;
+	Widget **candidates = hit_grid_query(grid, win->cursor, &count);
+
+	// States are settled before any handler runs, handlers may move or remove widgets.
+	for (int i = 0; i < count; i++) {
+		Widget *widget = candidates[i];
+		if (!widget_contains(widget, win->cursor))
+			continue;
+		on_widget = true;
+		// A held button keeps the widgets it pressed as they are.
+		if (!press && held)
+			continue;
+		int state = press ? 2 : 1;
+		if (widget->state == 0 && hit_grid_activate(grid, widget) != 0)
+			continue;
+		if (widget->state != state) {
+			widget->state = state;
+			invalidate_widget(widget);
+		}
+		candidates[hits++] = widget;
+	}
+	for (int i = 0; i < hits; i++) {
+		if (hit_grid_is_active(grid, candidates[i]))
+			signal_emit(candidates[i], press ? CLICK : HOVER);
+	}
+	return on_widget;
+}
 
-	if (!on_widget && left == GLFW_PRESS && last_state != GLFW_PRESS)
-		signal_emit(win, CLICK);
+// Widgets may have moved under a resting cursor, or the window switched contexts.
+static inline void refresh_widget_states(Window *win) {
+	if (win->context && (win->hitContext != win->context || win->hitVersion != win->context->hit_grid->version))
+		update_widget_states(win, false);
+}
+
+// Sends the signal to the widgets under the cursor, or to the window when there are none.
+static void emit_to_hovered(Window *win, enum SIGNAL signal) {
+	HitGrid *grid = win->context ? win->context->hit_grid : NULL;
+	if (!grid || !win->cursorInside || grid->activeCount == 0) {
+		signal_emit(win, signal);
+		return;
+	}
+	int count;
+	Widget **hovered = hit_grid_hovered(grid, &count);
+	for (int i = 0; i < count; i++) {
+		if (hit_grid_is_active(grid, hovered[i]))
+			signal_emit(hovered[i], signal);
+	}
+}
+
+void dispatch_input_events(Window *win) {
+	if (!win) return;
+	refresh_widget_states(win);
+
+	for (int i = 0; i < win->eventCount; i++) {
+		InputEvent event = win->events[i];
+		current_event = &event;
+		switch (event.type) {
+		case INPUT_CURSOR:
+			win->cursorInside = true;
+			win->cursor = event.position;
+			update_widget_states(win, false);
+			break;
+		case INPUT_CURSOR_LEAVE:
+			win->cursorInside = false;
+			update_widget_states(win, false);
+			break;
+		case INPUT_BUTTON: {
+			bool press = event.button == GLFW_MOUSE_BUTTON_LEFT && event.action == GLFW_PRESS;
+			if (event.action == GLFW_PRESS)
+				win->buttons |= 1 << event.button;
+			else
+				win->buttons &= ~(1 << event.button);
+			win->cursor = event.position;
+			if (!update_widget_states(win, press) && press)
+				signal_emit(win, CLICK);
+			break;
+		}
+		case INPUT_SCROLL:
+			emit_to_hovered(win, SCROLL);
+			break;
+		case INPUT_KEY:
+			emit_to_hovered(win, KEY);
+			break;
+		}
+	}
+	current_event = NULL;
+	win->eventCount = 0;
+
+	refresh_widget_states(win);
 }
 
 int get_alignment_offset_x(enum ALIGNMENT alignment, Size size, const char *text, Font *font) {
-	int pos = 0;
 	int text_width = 0;
 	int line_count = 1;
 	int max_width = 0;
@@ -262,16 +418,19 @@ int get_alignment_offset_x(enum ALIGNMENT alignment, Size size, const char *text
 				line_count++;
 				text_width = 0;
 			}
-			Glyph *glyph = (Glyph *)hashmap_get(font->glyphs, codepoint);
+			Glyph *glyph = font_get_glyph(font, codepoint);
 			if (glyph)
 				text_width += glyph->advance;
 			p += bytes;
 		}
 	}
 
-	int ascender = font->ascender * line_count;
 	text_width = max_width > text_width ? max_width : text_width;
+	return alignment_offset_x(alignment, size, text_width);
+}
 
+int alignment_offset_x(enum ALIGNMENT alignment, Size size, int text_width) {
+	int pos = 0;
 	switch (alignment)
 	{
 	case ALIGN_LEFT:
@@ -381,7 +540,7 @@ int utf8_strlen(const char *str) {
 	return len;
 }
 
-int text_width(const char* text, HashMap* glyphs) {
+int text_width(const char* text, Font* font) {
 	int width = 0;
 	int max_width = 0;
 	uint32_t codepoint;
@@ -397,21 +556,22 @@ int text_width(const char* text, HashMap* glyphs) {
 				width = 0;
 				continue;
 			}
-			Glyph *g = (Glyph *)hashmap_get(glyphs, codepoint);
-			width += g->advance;
+			Glyph *g = font_get_glyph(font, codepoint);
+			if (g)
+				width += g->advance;
 		}
 	}
 	return width > max_width ? width : max_width;
 }
 
-int line_count(const char *str, int width, HashMap *glyphs) {
+int line_count(const char *str, int width, Font *font) {
 	int linecount = 0;
 
 	char *cpy = malloc(strlen(str) + 1);
 	strcpy(cpy, str);
 	char *line = strtok(cpy, "\n");
 	while (line) {
-		linecount += (text_width(line, glyphs) + width - 1) / width;
+		linecount += (text_width(line, font) + width - 1) / width;
 		line = strtok(NULL, "\n");
 	}
 	free(cpy);
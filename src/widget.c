@@ -5,14 +5,23 @@ int destroy_widget(Widget *widget) {
 	if (!widget) return -1;
 
 	if (widget->font) {
-		free_font(widget->font);
+		release_font(widget->font);
 	}
 
 	if (widget->text) {
 		free(widget->text);
 	}
 
+	destroy_text_layout(widget->layout);
+	destroy_render_target(widget->cache);
+
 	if (widget->data) {
+		if (widget->render_func == render_canvas) {
+			command_buffer_free(&((canvasData *)widget->data)->commands);
+			cancel_canvas_exports((canvasData *)widget->data);
+			destroy_canvas_tiles((canvasData *)widget->data);
+			destroy_canvas_history(&((canvasData *)widget->data)->history);
+		}
 		free(widget->data);
 	}
 
@@ -23,7 +32,7 @@ int destroy_widget(Widget *widget) {
 static inline Widget *create_widget(Ck *ck, Position position, Size size, const char *font_name,
 							const char *text, enum ALIGNMENT text_alignment, float text_color[3]) {
 
-	Font *font = get_font(font_name, 16, &ck->ft);
+	Font *font = acquire_font(ck, font_name, 16);
 	if (!font) {
 		fprintf(stderr, "Failed to get font: %s\n", font_name);
 		return NULL;
@@ -32,14 +41,14 @@ static inline Widget *create_widget(Ck *ck, Position position, Size size, const
 	Widget *widget = malloc(sizeof(Widget));
 	if (!widget) {
 		fprintf(stderr, "Failed to allocate memory for Widget\n");
-		free_font(font);
+		release_font(font);
 		return NULL;
 	}
 	if (text) {
 		widget->text = malloc(strlen(text) + 1);
 		if (!widget->text) {
 			fprintf(stderr, "Failed to allocate memory for widget text\n");
-			free_font(font);
+			release_font(font);
 			free(widget);
 			return NULL;
 		}
@@ -47,6 +56,7 @@ static inline Widget *create_widget(Ck *ck, Position position, Size size, const
 	} else {
 		widget->text = NULL;
 	}
+	widget->layout = NULL;
 	widget->position = position;
 	widget->size = size;
 	widget->font = font;
@@ -55,7 +65,15 @@ static inline Widget *create_widget(Ck *ck, Position position, Size size, const
 	widget->text_color[1] = text_color[1];
 	widget->text_color[2] = text_color[2];
 	widget->state = 0;
-	}
+	widget->dirty = true;
+	widget->context = NULL;
+	widget->retained = false;
+	widget->cache = NULL;
+	widget->clip_mask = 0;
+	widget->grid_cells[0] = widget->grid_cells[1] = 0;
+	widget->grid_cells[2] = widget->grid_cells[3] = -1;
+	return widget;
+}
 
 Widget *create_push_button(Ck *ck, Position position, Size size, const char *font_name,
 							const char *text, enum ALIGNMENT text_alignment, float text_color[3]) {
@@ -74,6 +92,24 @@ Widget *create_push_button(Ck *ck, Position position, Size size, const char *fon
 	return button;
 }
 
+static inline void init_canvas_data(canvasData *data) {
+	data->bitmap = 0;
+	data->FBO = 0;
+	data->commands = (CommandBuffer){0};
+	data->lineMode = LINE_GEOMETRY;
+	data->minSegment = 0.0f;
+	data->tolerance = 0.0f;
+	data->exports = NULL;
+	data->tiles = NULL;
+	data->touched = NULL;
+	data->touchedCount = 0;
+	data->touchedCapacity = 0;
+	data->viewX = 0.0f;
+	data->viewY = 0.0f;
+	data->zoom = 1.0f;
+	data->history = (CanvasHistory){0};
+}
+
 Widget *create_canvas(Ck *ck, Position position, Size size, const char *font_name,
 						const char *text, enum ALIGNMENT text_alignment, float text_color[3]) {
 
@@ -86,12 +122,12 @@ Widget *create_canvas(Ck *ck, Position position, Size size, const char *font_nam
 	canvasData *data = malloc(sizeof(canvasData));
 	if (!data) {
 		fprintf(stderr, "Failed to allocate memory for canvas data\n");
-		free_font(canvas->font);
+		release_font(canvas->font);
 		free(canvas);
 		return NULL;
 	}
 
-	data->lineQueue = NULL;
+	init_canvas_data(data);
 	
 	data->bitmap = generate_texture(size.width, size.height, NULL);
 	
@@ -108,7 +144,7 @@ Widget *create_canvas(Ck *ck, Position position, Size size, const char *font_nam
 		glDeleteFramebuffers(1, &data->FBO);
 		glDeleteTextures(1, &data->bitmap);
 		free(data);
-		free_font(canvas->font);
+		release_font(canvas->font);
 		free(canvas);
 		return NULL;
 	}
@@ -132,6 +168,42 @@ Widget *create_canvas(Ck *ck, Position position, Size size, const char *font_nam
 	return canvas;
 }
 
+Widget *create_tiled_canvas(Ck *ck, Position position, Size size, const char *font_name,
+						const char *text, enum ALIGNMENT text_alignment, float text_color[3]) {
+
+	Widget *canvas = create_widget(ck, position, size, font_name, text, text_alignment, text_color);
+	if (!canvas) {
+		fprintf(stderr, "Failed to create canvas widget\n");
+		return NULL;
+	}
+
+	canvasData *data = malloc(sizeof(canvasData));
+	if (!data) {
+		fprintf(stderr, "Failed to allocate memory for canvas data\n");
+		release_font(canvas->font);
+		free(canvas);
+		return NULL;
+	}
+	init_canvas_data(data);
+
+	// Tiles are only allocated once a stroke lands on them.
+	data->tiles = hashmap_create(64);
+	if (!data->tiles) {
+		free(data);
+		release_font(canvas->font);
+		free(canvas);
+		return NULL;
+	}
+
+	canvas->data = data;
+	canvas->texture_index = 1;
+	canvas->render_func = render_canvas;
+
+	signal_emit(canvas, ACTIVATE);
+
+	return canvas;
+}
+
 Widget *create_textbox(Ck *ck, Position position, Size size, const char *font_name,
 						const char *text, float text_color[3], bool autoresize) {
 	Widget *textbox = create_widget(ck, position, size, font_name, text, ALIGN_TOP_LEFT, text_color);
@@ -1,51 +1,131 @@
 #include "../libs/ck.h"
 #include "../libs/ck_internal.h"
 
-void enqueue_line(Position start, Position end, bool erase, GLfloat color[3], float thickness, drawQueue **queue) {
-	if (start.x == end.x && start.y == end.y) return;
-
-	drawQueue *newLine = malloc(sizeof(drawQueue));
-	if (!newLine) {
-		fprintf(stderr, "Failed to allocate memory for new line\n");
-		return;
-	}
-	newLine->val.start = start;
-	newLine->val.end = end;
-	newLine->val.thickness = thickness;
-	newLine->val.color[0] = color[0];
-	newLine->val.color[1] = color[1];
-	newLine->val.color[2] = color[2];
-	newLine->val.erase = erase;
-	newLine->next = NULL;
-
-	if (*queue == NULL) {
-		*queue = newLine;
-	} else {
-		drawQueue *current = *queue;
-		while (current->next != NULL) {
-			current = current->next;
+CanvasCommand *command_buffer_push(CommandBuffer *buffer, enum CANVAS_COMMAND type) {
+	if (buffer->count == buffer->capacity) {
+		int capacity = buffer->capacity ? buffer->capacity * 2 : 64;
+		CanvasCommand *commands = realloc(buffer->commands, sizeof(CanvasCommand) * capacity);
+		if (!commands) {
+			fprintf(stderr, "Failed to allocate memory for canvas commands\n");
+			return NULL;
 		}
-		current->next = newLine;
+		buffer->commands = commands;
+		buffer->capacity = capacity;
 	}
+	CanvasCommand *command = &buffer->commands[buffer->count++];
+	command->type = type;
+	return command;
 }
 
-void dequeue_line(drawQueue **queue) {
-	if (queue == NULL || *queue == NULL) return;
+Position *command_buffer_push_points(CommandBuffer *buffer, const Position *points, int count) {
+	if (buffer->pointCount + count > buffer->pointCapacity) {
+		int capacity = buffer->pointCapacity ? buffer->pointCapacity : 256;
+		while (capacity < buffer->pointCount + count)
+			capacity *= 2;
+		Position *stored = realloc(buffer->points, sizeof(Position) * capacity);
+		if (!stored) {
+			fprintf(stderr, "Failed to allocate memory for canvas points\n");
+			return NULL;
+		}
+		buffer->points = stored;
+		buffer->pointCapacity = capacity;
+	}
+	Position *destination = &buffer->points[buffer->pointCount];
+	memcpy(destination, points, sizeof(Position) * count);
+	buffer->pointCount += count;
+	return destination;
+}
+
+// Keeps the storage, the next frame's commands reuse it.
+void command_buffer_reset(CommandBuffer *buffer) {
+	buffer->count = 0;
+	buffer->pointCount = 0;
+}
+
+void command_buffer_free(CommandBuffer *buffer) {
+	free(buffer->commands);
+	free(buffer->points);
+	free(buffer->keep);
+	free(buffer->stack);
+	*buffer = (CommandBuffer){0};
+}
+
+int set_canvas_line_mode(Widget *canvas, enum LINE_MODE mode) {
+	if (!canvas || canvas->render_func != render_canvas) {
+		fprintf(stderr, "Widget is not a canvas\n");
+		return -1;
+	}
+	((canvasData *)canvas->data)->lineMode = mode;
+	return 0;
+}
+
+int set_canvas_simplification(Widget *canvas, float min_segment, float tolerance) {
+	if (!canvas || canvas->render_func != render_canvas) {
+		fprintf(stderr, "Widget is not a canvas\n");
+		return -1;
+	}
+	canvasData *data = (canvasData *)canvas->data;
+	data->minSegment = min_segment > 0.0f ? min_segment : 0.0f;
+	data->tolerance = tolerance > 0.0f ? tolerance : 0.0f;
+	return 0;
+}
+
+int set_canvas_view(Widget *canvas, float x, float y, float zoom) {
+	if (!canvas || canvas->render_func != render_canvas) {
+		fprintf(stderr, "Widget is not a canvas\n");
+		return -1;
+	}
+	if (zoom <= 0.0f) {
+		fprintf(stderr, "Canvas zoom must be positive\n");
+		return -1;
+	}
+	canvasData *data = (canvasData *)canvas->data;
+	data->viewX = x;
+	data->viewY = y;
+	data->zoom = zoom;
+	invalidate_widget(canvas);
+	return 0;
+}
 
-	drawQueue *temp = *queue;
-	*queue = (*queue)->next;
-	free(temp);
+Position canvas_point(Widget *canvas, Position point) {
+	if (!canvas || canvas->render_func != render_canvas)
+		return point;
+	canvasData *data = (canvasData *)canvas->data;
+	return (Position){
+		data->viewX + (point.x - canvas->position.x) / data->zoom,
+		data->viewY + (point.y - canvas->position.y) / data->zoom
+	};
+}
 
+int set_canvas_history(Widget *canvas, size_t budget) {
+	if (!canvas || canvas->render_func != render_canvas) {
+		fprintf(stderr, "Widget is not a canvas\n");
+		return -1;
+	}
+	set_canvas_history_budget(&((canvasData *)canvas->data)->history, budget);
+	return 0;
 }
 
-int queue_length(drawQueue **queue) {
-	int length = 0;
-	drawQueue *current = *queue;
-	while (current != NULL) {
-		length++;
-		current = current->next;
+static int queue_history_command(Widget *canvas, enum CANVAS_COMMAND type) {
+	if (!canvas || canvas->render_func != render_canvas) {
+		fprintf(stderr, "Widget is not a canvas\n");
+		return -1;
 	}
-	return length;
+	canvasData *data = (canvasData *)canvas->data;
+	if (data->history.budget == 0)
+		return -1;
+	if (!command_buffer_push(&data->commands, type))
+		return -1;
+	invalidate_widget(canvas);
+	return 0;
+}
+
+int undo_canvas(Widget *canvas) {
+	return queue_history_command(canvas, CANVAS_UNDO);
+}
+
+int redo_canvas(Widget *canvas) {
+	return queue_history_command(canvas, CANVAS_REDO);
 }
 
 int draw_line_to_canvas(Position start, Position end, bool erase, GLfloat color[3], float thickness, Widget *canvas) {
@@ -56,7 +136,70 @@ int draw_line_to_canvas(Position start, Position end, bool erase, GLfloat color[
 
 	if (start.x == end.x && start.y == end.y) return 0;
 
-	enqueue_line(start, end, erase, color, thickness, &(((canvasData*)canvas->data)->lineQueue));
+	CanvasCommand *command = command_buffer_push(&((canvasData *)canvas->data)->commands, CANVAS_LINE);
+	if (!command)
+		return -1;
+	command->line = (Line){
+		.start = start,
+		.end = end,
+		.thickness = thickness,
+		.color = { color[0], color[1], color[2] },
+		.erase = erase
+	};
+	invalidate_widget(canvas);
+	return 0;
+}
+
+static int record_polyline(CommandBuffer *buffer, const Position *points, int count, bool erase, const GLfloat color[3], float thickness) {
+	if (!points || count <= 0)
+		return 0;
+	int first = buffer->pointCount;
+	if (!command_buffer_push_points(buffer, points, count))
+		return -1;
+	CanvasCommand *command = command_buffer_push(buffer, CANVAS_POLYLINE);
+	if (!command) {
+		buffer->pointCount = first;
+		return -1;
+	}
+	command->polyline = (Polyline){
+		.first = first,
+		.count = count,
+		.thickness = thickness,
+		.color = { color[0], color[1], color[2] },
+		.erase = erase
+	};
+	return 0;
+}
+
+int draw_polyline_to_canvas(const Position *points, int count, bool erase, GLfloat color[3], float thickness, Widget *canvas) {
+	if (!canvas || canvas->render_func != render_canvas) {
+		fprintf(stderr, "Widget is not a canvas\n");
+		return -1;
+	}
+
+	if (record_polyline(&((canvasData *)canvas->data)->commands, points, count, erase, color, thickness) != 0)
+		return -1;
+	invalidate_widget(canvas);
+	return 0;
+}
+
+int draw_strokes_to_canvas(const Stroke *strokes, int count, Widget *canvas) {
+	if (!canvas || canvas->render_func != render_canvas) {
+		fprintf(stderr, "Widget is not a canvas\n");
+		return -1;
+	}
+	if (!strokes || count <= 0) return 0;
+
+	CommandBuffer *buffer = &((canvasData *)canvas->data)->commands;
+	for (int i = 0; i < count; i++) {
+		const Stroke *stroke = &strokes[i];
+		if (record_polyline(buffer, stroke->points, stroke->count, stroke->erase, stroke->color, stroke->thickness) != 0) {
+			// The strokes recorded so far still get drawn.
+			invalidate_widget(canvas);
+			return -1;
+		}
+	}
+	invalidate_widget(canvas);
 	return 0;
 }
 
@@ -68,17 +211,36 @@ int set_widget_texture(Ck *ck, Widget *widget, const char *texture_path) {
 		fprintf(stderr, "No window available to set texture\n");
 		return -1;
 	}
-	GLuint textureID = load_texture(texture_path);
-	if (textureID == 0) {
+	int index = skin_atlas_load(win->skins, texture_path);
+	if (index < 0) {
 		fprintf(stderr, "Failed to load texture: %s\n", texture_path);
 		return -1;
 	}
-	int textureCount = 0;
-	while (win->textures[textureCount] != 0) textureCount++;
-	win->textures = realloc(win->textures, sizeof(GLuint) * (textureCount + 2));
-	win->textures[textureCount] = textureID;
-	win->textures[textureCount + 1] = 0;
-	widget->texture_index = textureCount;
+	widget->texture_index = index;
+	invalidate_widget(widget);
+	return 0;
+}
+
+int set_widget_position(Widget *widget, Position position) {
+	if (!widget) return -1;
+	if (widget->position.x == position.x && widget->position.y == position.y)
+		return 0;
+	widget->position = position;
+	invalidate_widget(widget);
+	if (widget->context)
+		return hit_grid_update(widget->context->hit_grid, widget);
+	return 0;
+}
+
+int set_widget_size(Widget *widget, Size size) {
+	if (!widget) return -1;
+	if (widget->size.width == size.width && widget->size.height == size.height)
+		return 0;
+	widget->size = size;
+	invalidate_widget(widget);
+	signal_emit(widget, RESIZE);
+	if (widget->context)
+		return hit_grid_update(widget->context->hit_grid, widget);
 	return 0;
 }
 
@@ -87,7 +249,7 @@ int textbox_width(Widget *widget) {
 	char *copy = strdup(widget->text);
 	char *line = strtok(copy, "\n");
 	while (line != NULL) {
-		int lineWidth = text_width(line, widget->font->glyphs);
+		int lineWidth = text_width(line, widget->font);
 		if (lineWidth > width) {
 			width = lineWidth;
 		}
@@ -95,4 +257,23 @@ int textbox_width(Widget *widget) {
 	}
 	free(copy);
 	return width + 20;
-}
\ No newline at end of file
+}
+
+void invalidate_widget(Widget *widget) {
+	if (!widget) return;
+	widget->dirty = true;
+	if (widget->cache)
+		widget->cache->valid = false;
+	invalidate_context(widget->context);
+}
+
+int set_widget_retained(Widget *widget, bool retained) {
+	if (!widget) return -1;
+	widget->retained = retained;
+	if (!retained) {
+		destroy_render_target(widget->cache);
+		widget->cache = NULL;
+	}
+	invalidate_widget(widget);
+	return 0;
+}
@@ -1,6 +1,26 @@
 #include "../libs/ck.h"
 #include "../libs/ck_internal.h"
 
+// Undoes a partly created window, the first window also owns the shaders and skins.
+static Window *abandon_window(Window *win, bool ownsShared) {
+	stream_buffer_destroy(win->quadStream);
+	stream_buffer_destroy(win->lineStream);
+	stream_buffer_destroy(win->strokeStream);
+	text_batch_destroy(win->textBatch);
+	line_batch_destroy(win->lineBatch);
+	instance_batch_destroy(win->backgroundBatch);
+	glDeleteBuffers(1, &win->frameUniforms);
+	if (ownsShared) {
+		for (int i = 0; i < 5; i++)
+			destroy_shader(win->shaderPrograms[i]);
+		skin_atlas_destroy(win->skins);
+	}
+	glfwTerminate();
+	free(win->title);
+	free(win);
+	return NULL;
+}
+
 Window *create_window(Ck *ck, int width, int height, const char *title) {
 	Window *win = (Window *)malloc(sizeof(Window));
 	if (!win) {
@@ -10,6 +30,15 @@ Window *create_window(Ck *ck, int width, int height, const char *title) {
 
 	win->width = width;
 	win->height = height;
+	win->context = NULL;
+	win->rendered_context = NULL;
+	win->dirty = true;
+	win->framebuffer = 0;
+	win->offscreen = false;
+	win->clip_depth = 0;
+	win->clip_overflow = 0;
+	win->clip_origin[0] = 0;
+	win->clip_origin[1] = 0;
 	win->title = malloc(strlen(title) + 1);
 	if (!win->title) {
 		fprintf(stderr, "Failed to allocate memory for window title\n");
@@ -25,13 +54,19 @@ Window *create_window(Ck *ck, int width, int height, const char *title) {
 		win->window = glfwCreateWindow(width, height, title, NULL, ck->windows[0]->window);
 	if (!win->window) {
 		fprintf(stderr, "Failed to create GLFW window\n");
-		free(win);
 		free(win->title);
+		free(win);
 		return NULL;
 	}
 
 	glfwSetFramebufferSizeCallback(win->window, framebuffer_size_callback);
 	glfwSetWindowCloseCallback(win->window, window_close_callback);
+	glfwSetWindowRefreshCallback(win->window, window_refresh_callback);
+	glfwSetCursorPosCallback(win->window, cursor_position_callback);
+	glfwSetCursorEnterCallback(win->window, cursor_enter_callback);
+	glfwSetMouseButtonCallback(win->window, mousebutton_callback);
+	glfwSetScrollCallback(win->window, scroll_callback);
+	glfwSetKeyCallback(win->window, key_callback);
 
 	glfwSetWindowUserPointer(win->window, ck);
 	glfwMakeContextCurrent(win->window);
@@ -39,6 +74,7 @@ Window *create_window(Ck *ck, int width, int height, const char *title) {
 	if (glewInit() != GLEW_OK) {
 		fprintf(stderr, "Failed to initialize GLEW\n");
 		glfwTerminate();
+		free(win->title);
 		free(win);
 		return NULL;
 	}
@@ -51,80 +87,91 @@ Window *create_window(Ck *ck, int width, int height, const char *title) {
 	glEnable(GL_DEBUG_OUTPUT);
 	glDebugMessageCallback(debug_callback, NULL);
 	
-	win->textures = malloc(sizeof(GLuint) * 4);
-	if (!win->textures) {
-		fprintf(stderr, "Failed to allocate memory for textures\n");
-		glfwTerminate();
-		free(win->title);
-		free(win);
-		return NULL;
+	glGenBuffers(1, &win->frameUniforms);
+	glBindBuffer(GL_UNIFORM_BUFFER, win->frameUniforms);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(GLfloat) * 4, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	win->frameSize.width = width;
+	win->frameSize.height = height;
+
+	// VAOs are not shared between contexts, so every window streams through its own.
+	win->quadStream = stream_buffer_create(sizeof(GLfloat) * 4 * 6 * 1024, 4);
+	win->lineStream = stream_buffer_create(sizeof(Position) * 256 * LINE_VERTEX_COUNT, 2);
+	const GLint strokeLayout[3] = { 2, 4, 1 };
+	win->strokeStream = stream_buffer_create_attributes(sizeof(StrokeVertex) * 6 * 1024, strokeLayout, 3);
+	win->textBatch = text_batch_create();
+	win->lineBatch = line_batch_create();
+	win->backgroundBatch = instance_batch_create();
+	win->backgrounds_batched = false;
+	win->events = NULL;
+	win->eventCount = 0;
+	win->eventCapacity = 0;
+	win->cursor = mouse_position(win);
+	win->buttons = 0;
+	win->cursorInside = glfwGetWindowAttrib(win->window, GLFW_HOVERED);
+	win->hitContext = NULL;
+	win->hitVersion = 0;
+	for (int i = 0; i < 5; i++)
+		win->shaderPrograms[i] = NULL;
+	win->skins = NULL;
+	if (!win->quadStream || !win->lineStream || !win->strokeStream || !win->textBatch || !win->lineBatch || !win->backgroundBatch) {
+		fprintf(stderr, "Failed to create window render buffers\n");
+		return abandon_window(win, false);
 	}
-	win->textures[3] = 0;
-		
+
 	if (ck->window_count == 0) {
 		win->shaderPrograms[0] = load_shader("shaders/text_vertex.glsl", "shaders/text_fragment.glsl");
 		if (!win->shaderPrograms[0]) {
 			fprintf(stderr, "Failed to load text shader program\n");
-			glfwTerminate();
-			free(win);
-			free(win->title);
-			free(win->textures);
-			return NULL;
+			return abandon_window(win, true);
 		}
 		win->shaderPrograms[1] = load_shader("shaders/texture_vertex.glsl", "shaders/texture_fragment.glsl");
 		if (!win->shaderPrograms[1]) {
 			fprintf(stderr, "Failed to load texture shader program\n");
-			glfwTerminate();
-			free(win);
-			free(win->title);
-			free(win->textures);
-			return NULL;
+			return abandon_window(win, true);
 		}
 
 		win->shaderPrograms[2] = load_shader("shaders/line_vertex.glsl", "shaders/line_fragment.glsl");
 		if (!win->shaderPrograms[2]) {
 			fprintf(stderr, "Failed to load line shader program\n");
-			glfwTerminate();
-			free(win);
-			free(win->title);
-			free(win->textures);
-			return NULL;
+			return abandon_window(win, true);
 		}
 
-		win->textures[0] = load_texture("assets/Button.png");
-		if (!win->textures[0]) {
+		// Optional, contexts fall back to drawing backgrounds one by one without it.
+		win->shaderPrograms[3] = load_shader("shaders/instanced_texture_vertex.glsl", "shaders/instanced_texture_fragment.glsl");
+		// Optional, LINE_SDF canvases draw with geometry without it.
+		win->shaderPrograms[4] = load_shader("shaders/stroke_sdf_vertex.glsl", "shaders/stroke_sdf_fragment.glsl");
+
+		win->skins = skin_atlas_create();
+		if (!win->skins)
+			return abandon_window(win, true);
+		// Built-in widgets refer to these skins by index 0, 1 and 2.
+		if (skin_atlas_load(win->skins, "assets/Button.png") != 0) {
 			fprintf(stderr, "Failed to load button texture\n");
-			glfwTerminate();
-			free(win);
-			free(win->title);
-			free(win->textures);
-			return NULL;
+			return abandon_window(win, true);
 		}
-		win->textures[1] = load_texture("assets/Canvas.png");
-		if (!win->textures[1]) {
+		if (skin_atlas_load(win->skins, "assets/Canvas.png") != 1) {
 			fprintf(stderr, "Failed to load canvas texture\n");
-			glfwTerminate();
-			free(win);
-			free(win->title);
-			free(win->textures);
-			return NULL;
+			return abandon_window(win, true);
+		}
+		if (skin_atlas_load(win->skins, "assets/TextBox.png") != 2) {
+			fprintf(stderr, "Failed to load textbox texture\n");
+			return abandon_window(win, true);
 		}
-		win->textures[2] = load_texture("assets/TextBox.png");
 	} else {
 		win->shaderPrograms[0] = ck->windows[0]->shaderPrograms[0];
 		win->shaderPrograms[1] = ck->windows[0]->shaderPrograms[1];
 		win->shaderPrograms[2] = ck->windows[0]->shaderPrograms[2];
-		win->textures[0] = ck->windows[0]->textures[0];
-		win->textures[1] = ck->windows[0]->textures[1];
+		win->shaderPrograms[3] = ck->windows[0]->shaderPrograms[3];
+		win->shaderPrograms[4] = ck->windows[0]->shaderPrograms[4];
+		win->skins = ck->windows[0]->skins;
 	}
 
 	if (!ck->windows) {
 		ck->windows = malloc(sizeof(Window *));
 		if (!ck->windows) {
 			fprintf(stderr, "Failed to allocate memory for windows array\n");
-			glfwTerminate();
-			free(win);
-			return NULL;
+			return abandon_window(win, true);
 		}
 		ck->windows[0] = win;
 		ck->window_count++;
@@ -132,9 +179,7 @@ Window *create_window(Ck *ck, int width, int height, const char *title) {
 		ck->windows = realloc(ck->windows, sizeof(Window *) * (ck->window_count + 1));
 		if (!ck->windows) {
 			fprintf(stderr, "Failed to reallocate memory for windows array\n");
-			glfwTerminate();
-			free(win);
-			return NULL;
+			return abandon_window(win, ck->window_count == 0);
 		}
 		ck->windows[ck->window_count] = win;
 		ck->window_count++;
@@ -159,10 +204,28 @@ void destroy_window(Window *win) {
 		}
 	}
 	if (win) {
-		if (win->window)
+		if (win->window) {
+			glfwMakeContextCurrent(win->window);
+			stream_buffer_destroy(win->quadStream);
+			stream_buffer_destroy(win->lineStream);
+			stream_buffer_destroy(win->strokeStream);
+			text_batch_destroy(win->textBatch);
+			line_batch_destroy(win->lineBatch);
+			instance_batch_destroy(win->backgroundBatch);
+			glDeleteBuffers(1, &win->frameUniforms);
+			// Shader programs are shared by every window of the Ck instance.
+			if (ck->window_count == 0) {
+				for (int i = 0; i < 5; i++)
+					destroy_shader(win->shaderPrograms[i]);
+				skin_atlas_destroy(win->skins);
+				// Last chance to delete the glyph atlases with a context current.
+				release_font_pages(ck->fonts);
+			}
 			glfwDestroyWindow(win->window);
+		}
 		if (win->title)
 			free((char *)win->title);
+		free(win->events);
 		free(win);
 	}
 }
@@ -185,7 +248,21 @@ int set_window_size(Window *win, int width, int height) {
 		glfwSetWindowSize(win->window, width, height);
 		win->width = width;
 		win->height = height;
+		invalidate_window(win);
 		return 0;
 	}
 	return -1;
-}
\ No newline at end of file
+}
+
+RenderStats window_render_stats(Window *win) {
+	if (!win)
+		return (RenderStats){0};
+	return win->stats;
+}
+
+void invalidate_window(Window *win) {
+	if (!win || win->dirty) return;
+	win->dirty = true;
+	// wakes loopCK when called from a GLFW callback while it waits for events
+	glfwPostEmptyEvent();
+}